@@ -121,6 +121,19 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// 返回一个内容清零的已锁定buf，不从磁盘读取。
+// 用于新分配的、马上就要整块写回的块。
+struct buf*
+bclear(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->valid = 1;
+  return b;
+}
+
 // 将b的内容写入磁盘。必须锁定。
 void
 bwrite(struct buf *b)
@@ -10,10 +10,13 @@ struct stat;
 struct superblock;
 struct mbuf;
 struct sock;
+struct vma;
+struct kcache;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bclear(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
@@ -26,6 +29,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -35,6 +39,7 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             fileadvise(struct file*, uint, uint, int);
 
 // fs.c
 void            fsinit(int);
@@ -55,6 +60,10 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+uint64          igetpage(struct inode*, uint);
+void            ireadahead(struct inode*, uint, uint);
+void            orphanwake(void);
+void            reclaimer(void);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -66,14 +75,38 @@ void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
 void            kref(uint64);
+int             krefcnt(uint64);
+extern char     *zeropage;
+
+// slab.c
+void            kmallocinit(void);
+void            kcacheinit(struct kcache*, char*, uint, void (*)(void*));
+void*           kcachealloc(struct kcache*);
+void            kcachefree(struct kcache*, void*);
+void*           kmalloc(uint);
+void            kmfree(void*);
+int             statsslab(char*, int);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            log_bfree(uint);
+int             log_bfreed(uint);
+int             log_room(void);
+
+// pcache.c
+void            pcacheinit(void);
+uint64          pcacheget(uint, uint, uint);
+void            pcacheput(uint, uint, uint, uint64);
+void            pcachewrite(uint, uint, uint, void*, uint);
+void            pcachedrop(uint, uint);
+void            pcacheevict(uint, uint, uint, uint);
+int             pcachereclaim(int);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -89,10 +122,15 @@ void            backtrace(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, int*);
+int             clone(uint64, uint64, uint64);
+struct mm*      mmalloc(void);
+int             mmleave(struct mm*);
+void            mmput(struct mm*, pagetable_t, uint64);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
-void            proc_freepagetable(pagetable_t, uint64, uint64);
+void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
@@ -103,21 +141,34 @@ void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kproc(void (*)(void), char*);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
-int             handle_pagefault(uint64, struct proc*);
-int             handle_kpagefault(uint64, struct proc*);
+int             handle_pagefault(uint64, struct proc*, int);
+int             statsfault(char*, int);
+int             handle_kpagefault(uint64, struct proc*, int);
+int             populate(struct proc*, uint64, uint64, int);
+int             uvmfault(struct proc*, uint64, int);
+void            mmlock(struct mm*);
+int             uvmprefault(struct proc*, uint64, uint64);
+
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
 
 // spinlock.c
 void            acquire(struct spinlock*);
+int             tryacquire(struct spinlock*);
 int             holding(struct spinlock*);
+int             holdingspin(void);
 void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
@@ -128,6 +179,7 @@ void            freelock(struct spinlock*);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
@@ -175,6 +227,7 @@ uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
+void            uvmzap(struct proc*, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
@@ -182,11 +235,16 @@ int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 void            vmprint(pagetable_t);
-pagetable_t     proc_kpagetable(void);
-void            proc_kfreepagetable(pagetable_t pagetable);
-int             kvmcopy(pagetable_t, pagetable_t, uint64, uint64);
-uint64          kvmdealloc(pagetable_t, uint64, uint64);
-int             mmapcopy(pagetable_t, pagetable_t, uint64);
+void            uvmkmap(pagetable_t);
+void            asidinit(void);
+void            uvmswitch(struct proc*);
+void            kvmswitch(void);
+void            uvmflush(struct proc*);
+void            uvmflushhart(void);
+void            tlbpoll(void);
+int             uvmunshare(pagetable_t, uint64);
+int             mmapcopy(pagetable_t, pagetable_t, uint64, uint64, int);
+int             cowpage(pte_t*);
 
 // plic.c
 void            plicinit(void);
@@ -194,6 +252,23 @@ void            plicinithart(void);
 int             plic_claim(void);
 void            plic_complete(int);
 
+// vma.c
+void            vmainit(void);
+struct vma*     vmaalloc(void);
+void            vmafree(struct vma*);
+void            vmainsert(struct vma**, struct vma*);
+void            vmaremove(struct vma**, struct vma*);
+struct vma*     vmafind(struct vma*, uint64);
+struct vma*     vmalookup(struct vma*, uint64);
+uint64          vmagap(struct vma*, uint64, uint64, uint64);
+int             vmaflush(struct proc*, struct vma*, uint64, uint64);
+int             vmasync(struct proc*, uint64, uint64);
+int             statsvma(char*, int);
+int             vmaunmap(struct proc*, uint64, uint64);
+int             vmafork(struct proc*, struct proc*);
+void            vmafreeall(struct vma**);
+int             vmadvise(struct proc*, uint64, uint64, int);
+
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
@@ -219,6 +294,8 @@ void            e1000_intr(void);
 int             e1000_transmit(struct mbuf*);
 
 // net.c
+void            mbufinit(void);
+int             statsmbuf(char*, int);
 void            net_rx(struct mbuf*);
 void            net_tx_udp(struct mbuf*, uint32, uint16, uint16);
 
@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
 #include "e1000_dev.h"
@@ -123,23 +124,40 @@ e1000_transmit(struct mbuf *m)
   release(&e1000_lock); return 0;
 }
 
+// 先收集所有收到的包，一次从池子里拿同样多的新缓存换上，
+// 最后写一次RDT把描述符还给网卡，再把包交给net_rx()。
+// 缓存不够的话丢掉多出来的包（池子的allocfail会加一），原来的缓存留在环里接着用。
 static void
 e1000_recv(void)
 {
-  //
-  // Your code here.
-  //
-  // Check for packets that have arrived from the e1000
-  // Create and deliver an mbuf for each packet (using net_rx()).
-  //
-  for (;;) {
-      uint32 index = (regs[E1000_RDT] + 1) % RX_RING_SIZE;
-      if ((rx_ring[index].status & E1000_RXD_STAT_DD) == 0) break;
-      rx_mbufs[index]->len = rx_ring[index].length;
-      net_rx(rx_mbufs[index]); rx_mbufs[index] = mbufalloc(0);
-      rx_ring[index].addr = (uint64)rx_mbufs[index]->head; rx_ring[index].status = 0;
-      regs[E1000_RDT] = index;
+  struct mbuf *fresh[RX_RING_SIZE], *done[RX_RING_SIZE];
+  uint32 tail = regs[E1000_RDT], index;
+  int i, n, nfresh;
+
+  for (n = 0; n < RX_RING_SIZE - 1; n++) {
+    index = (tail + 1 + n) % RX_RING_SIZE;
+    if ((rx_ring[index].status & E1000_RXD_STAT_DD) == 0)
+      break;
   }
+  if (n == 0)
+    return;
+
+  nfresh = mbufallocn(fresh, n, 0);
+  for (i = 0; i < n; i++) {
+    index = (tail + 1 + i) % RX_RING_SIZE;
+    if (i < nfresh) {
+      done[i] = rx_mbufs[index];
+      done[i]->len = rx_ring[index].length;
+      rx_mbufs[index] = fresh[i];
+      rx_ring[index].addr = (uint64)fresh[i]->head;
+    }
+    rx_ring[index].status = 0;
+  }
+  __sync_synchronize();
+  regs[E1000_RDT] = (tail + n) % RX_RING_SIZE;
+
+  for (i = 0; i < nfresh; i++)
+    net_rx(done[i]);
 }
 
 void
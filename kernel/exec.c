@@ -3,14 +3,26 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
+#include "fs.h"
+#include "file.h"
 #include "elf.h"
-
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+#include "fcntl.h"
 
 int
 exec(char *path, char **argv)
+{
+  return execproc(myproc(), path, argv);
+}
+
+// 把path的程序装进进程p，换掉它原来的用户映像。
+// p是当前进程（exec()），或者是还没有运行过的新进程（spawn()）。
+// p换一个新的地址空间，原来的留给和它共享的线程（clone()）。
+// 成功时返回argc，失败时p不变。
+int
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
@@ -19,7 +31,9 @@ exec(char *path, char **argv)
   struct inode *ip;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+  struct vma *vmas = 0, *v;
+  struct mm *mm = 0, *oldmm;
+  uint64 oldtrapframeva;
 
   begin_op();
 
@@ -35,10 +49,10 @@ exec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
-  if((pagetable = proc_pagetable(p)) == 0)
+  if((mm = mmalloc()) == 0 || (pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // 将程序加载到内存中。
+  // 为每个段建一个私有的文件映射，第一次访问的时候再从文件读进来。
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -48,29 +62,44 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+    // 段的内容要在文件里，不然缺页时读到的是文件末尾以后补的零
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
+      goto bad;
+    if(ph.vaddr % PGSIZE != 0 || ph.vaddr < PGROUNDUP(sz))
       goto bad;
-    sz = sz1;
-    if(ph.vaddr % PGSIZE != 0)
+    if(ph.vaddr + ph.memsz >= KERNBASE)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.memsz == 0)
+      continue;
+    if((v = vmaalloc()) == 0)
       goto bad;
+    v->start = ph.vaddr;
+    v->end = PGROUNDUP(ph.vaddr + ph.memsz);
+    v->fend = ph.vaddr + ph.filesz;
+    v->off = ph.off;
+    v->prot = 0;
+    if(ph.flags & ELF_PROG_FLAG_READ)
+      v->prot |= PROT_READ;
+    if(ph.flags & ELF_PROG_FLAG_WRITE)
+      v->prot |= PROT_WRITE;
+    if(ph.flags & ELF_PROG_FLAG_EXEC)
+      v->prot |= PROT_EXEC;
+    v->flags = MAP_PRIVATE;
+    v->ip = idup(ip);
+    vmainsert(&vmas, v);
+    sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
-  uint64 oldsz = p->sz;
-
   // 在下一页边界处分配两页。
   // 使用第二个作为用户堆栈。
   sz = PGROUNDUP(sz);
   uint64 sz1;
   if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE)) == 0)
     goto bad;
-  if(sz1 >= PLIC)
+  if(sz1 >= KERNBASE)
     goto bad;
   sz = sz1;
   uvmclear(pagetable, sz-2*PGSIZE);
@@ -110,17 +139,25 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // 提交到用户映像。
+  // 旧的地址空间没有别的线程在用了的话解除映射
+  if(mmleave(p->mm))
+    vmaunmap(p, 0, MMAPTOP);
+  oldmm = p->mm;
   oldpagetable = p->pagetable;
+  oldtrapframeva = p->trapframeva;
+  mm->vmas = vmas;
+  mm->sz = sz;
+  p->mm = mm;
   p->pagetable = pagetable;
+  p->trapframeva = TRAPFRAME;
 
-  // 销毁用户内核页表
-  kvmdealloc(p->kpagetable, p->sz, 0);
+  // 内核正在旧页表上运行，释放它之前先切换到新的，新的地址空间用新的ASID
+  if(p == myproc())
+    uvmswitch(p);
 
-  p->sz = sz;
   p->trapframe->epc = elf.entry;  // 初始程序计数器 = main
   p->trapframe->sp = sp; // 初始堆栈指针
-  proc_freepagetable(oldpagetable, oldsz, p->mmapsz);
-  p->mmapsz = 0;
+  mmput(oldmm, oldpagetable, oldtrapframeva);
 
   // 打印init的页表 （lab pagetable）
   if(p->pid==1) vmprint(p->pagetable);
@@ -128,39 +165,14 @@ exec(char *path, char **argv)
   return argc; // 结果是a0，main(argc, argv)的第一个参数
 
  bad:
-  if(pagetable)
-    proc_freepagetable(pagetable, sz, p->mmapsz);
+  if(mm){
+    mm->sz = sz;
+    mmput(mm, pagetable, TRAPFRAME);
+  }
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  vmafreeall(&vmas);
   return -1;
 }
-
-// 将程序段加载到虚拟地址va处的pagetable中。
-// va必须页对齐
-// 从va到va+sz的页面必须已经被映射。
-// 成功时返回0，失败时返回-1。
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
-{
-  uint i, n;
-  uint64 pa;
-
-  if((va % PGSIZE) != 0)
-    panic("loadseg: va must be page aligned");
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
-  return 0;
-}
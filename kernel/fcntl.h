@@ -12,4 +12,29 @@
 #define PROT_EXEC       0x4
 
 #define MAP_SHARED      0x01
-#define MAP_PRIVATE     0x02
\ No newline at end of file
+#define MAP_PRIVATE     0x02
+#define MAP_ANONYMOUS   0x20    // 不对应文件，懒分配的零页
+#define MAP_POPULATE    0x8000  // 预先映射整个区域，也可以给sbrkf()用
+
+// msync
+#define MS_ASYNC        0x1
+#define MS_SYNC         0x4
+
+// madvise
+#define MADV_NORMAL     0
+#define MADV_RANDOM     1       // 不做fault-around
+#define MADV_SEQUENTIAL 2       // fault-around的范围加倍
+#define MADV_WILLNEED   3       // 马上把页映射好
+#define MADV_DONTNEED   4       // 马上释放页，再访问的时候重新缺页
+
+// fadvise
+#define POSIX_FADV_NORMAL     0
+#define POSIX_FADV_RANDOM     1 // 不预读
+#define POSIX_FADV_SEQUENTIAL 2 // 预读的范围加倍
+#define POSIX_FADV_WILLNEED   3 // 马上读进页缓存
+#define POSIX_FADV_DONTNEED   4 // 从页缓存丢掉（被映射的页除外）
+#define POSIX_FADV_NOREUSE    5 // 读过的页马上从页缓存丢掉
+
+// futex
+#define FUTEX_WAIT      0       // 值还是val的话睡眠
+#define FUTEX_WAKE      1       // 唤醒最多val个等待的进程
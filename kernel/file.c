@@ -12,6 +12,7 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "fcntl.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -35,6 +36,8 @@ filealloc(void)
   for(f = ftable.file; f < ftable.file + NFILE; f++){
     if(f->ref == 0){
       f->ref = 1;
+      f->advice = POSIX_FADV_NORMAL;
+      f->ra = 0;
       release(&ftable.lock);
       return f;
     }
@@ -103,6 +106,28 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// 顺序读文件f的时候，预读窗口用掉一半就把后面READAHEAD页读进页缓存，
+// POSIX_FADV_SEQUENTIAL预读两倍，POSIX_FADV_RANDOM不预读。
+// 调用者必须持有f->ip->lock。
+static void
+readahead(struct file *f)
+{
+  uint win, start;
+
+  if(f->advice == POSIX_FADV_RANDOM || f->advice == POSIX_FADV_NOREUSE)
+    return;
+  win = READAHEAD * PGSIZE;
+  if(f->advice == POSIX_FADV_SEQUENTIAL)
+    win *= 2;
+  if(f->ra > f->off + win / 2)
+    return;
+  start = PGROUNDUP(f->off);
+  if(f->ra > start)
+    start = f->ra;
+  ireadahead(f->ip, start, PGROUNDUP(f->off) + win);
+  f->ra = PGROUNDUP(f->off) + win;
+}
+
 // 从文件f读取。
 // addr是一个用户虚拟地址。
 int
@@ -121,8 +146,12 @@ fileread(struct file *f, uint64 addr, int n)
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    if((r = readi(f->ip, 1, addr, f->off, n)) > 0){
+      if(f->advice == POSIX_FADV_NOREUSE)
+        pcacheevict(f->ip->dev, f->ip->inum, PGROUNDDOWN(f->off), f->off + r);
       f->off += r;
+      readahead(f);
+    }
     iunlock(f->ip);
   } else if(f->type == FD_SOCK){
     r = sockread(f->sock, addr, n);
@@ -151,13 +180,10 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // 一次写几个块以避免超过
-    // 最大日志事务大小，包括
-    // i-node，间接块，分配块，
-    // 和2块用于非对齐写入的slop。
-    // 这真的属于下层，因为writei()
-    // 可能在写一个像控制台这样的设备。
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    // 有序模式下文件数据直接写回原位，一个事务里只记录
+    // inode、间接块和位图块，所以每次可以写很多块。
+    // 日志空间不够时writei()会提前返回，剩下的放到下一个事务。
+    int max = NINDIRECT * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
@@ -171,7 +197,7 @@ filewrite(struct file *f, uint64 addr, int n)
       iunlock(f->ip);
       end_op();
 
-      if(r != n1){
+      if(r <= 0){
         // writei发生错误
         break;
       }
@@ -189,3 +215,36 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// fadvise()：告诉内核以后怎么读文件f的[off, off+len)，len为0表示到文件末尾。
+// NORMAL、RANDOM、SEQUENTIAL和NOREUSE只改f以后的预读和缓存方式，
+// WILLNEED马上预读，DONTNEED把没有被映射的页从页缓存丢掉。
+int
+fileadvise(struct file *f, uint off, uint len, int advice)
+{
+  struct inode *ip = f->ip;
+  uint end = off + len;
+
+  if(f->type != FD_INODE || ip->type != T_FILE)
+    return -1;
+  if(len == 0 || end < off)
+    end = ~0U;
+  switch(advice){
+  case POSIX_FADV_NORMAL:
+  case POSIX_FADV_RANDOM:
+  case POSIX_FADV_SEQUENTIAL:
+  case POSIX_FADV_NOREUSE:
+    f->advice = advice;
+    break;
+  case POSIX_FADV_WILLNEED:
+    ilock(ip);
+    ireadahead(ip, off, end);
+    iunlock(ip);
+    break;
+  case POSIX_FADV_DONTNEED:
+    pcacheevict(ip->dev, ip->inum, off, end);
+    break;
+  default:
+    return -1;
+  }
+  return 0;
+}
@@ -7,6 +7,8 @@ struct file {
   struct inode *ip;  // FD_INODE 和 FD_DEVICE
   struct sock *sock; // FD_SOCK
   uint off;          // FD_INODE
+  int advice;        // FD_INODE，fadvise()
+  uint ra;           // FD_INODE，已经预读到的文件偏移
   short major;       // FD_DEVICE
 };
 
@@ -13,8 +13,8 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
-#include "proc.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
@@ -23,6 +23,13 @@
 // 每个磁盘设备应该有一个超级块，但我们只使用一个设备运行
 struct superblock sb; 
 
+// 孤儿：没有链接也没有引用、等待后台截断的大文件。
+// 磁盘上的孤儿表放在超级块里，崩溃以后fsinit()会让回收进程继续截断。
+struct {
+  struct spinlock lock;
+  int pending;    // 有新的孤儿需要回收
+} orphan;
+
 // 读取超级块（super block）.
 static void
 readsb(int dev, struct superblock *sb)
@@ -37,10 +44,17 @@ readsb(int dev, struct superblock *sb)
 // 初始化文件系统
 void
 fsinit(int dev) {
+  int i;
+
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  // 恢复日志以后重新读一遍，孤儿表可能在日志里
+  readsb(dev, &sb);
+  for(i = 0; i < NORPHAN; i++)
+    if(sb.orphans[i])
+      orphanwake();
 }
 
 // 清零一个块
@@ -57,9 +71,15 @@ bzero(int dev, int bno)
 
 // 块（Blocks）.
 
-// 分配一个清零过的磁盘块
+// 有序模式下写一个数据块最多会进日志的元数据块：
+// 每次分配一个位图块、两个新的间接块和它们的父块，再加上inode
+#define ORDMETA 7
+
+// 在位图中找一个空闲块并标记为已用，不清零。
+// 跳过本事务中刚释放的块：有序模式下文件数据直接写回原位，
+// 不能在释放提交之前覆盖这些块原来的内容。
 static uint
-balloc(uint dev)
+bfind(uint dev)
 {
   int b, bi, m;
   struct buf *bp;
@@ -69,11 +89,10 @@ balloc(uint dev)
     bp = bread(dev, BBLOCK(b, sb));
     for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
       m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // 块空闲?
+      if((bp->data[bi/8] & m) == 0 && !log_bfreed(b + bi)){  // 块空闲?
         bp->data[bi/8] |= m;  // 标志块被使用了.
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
         return b + bi;
       }
     }
@@ -82,6 +101,17 @@ balloc(uint dev)
   panic("balloc: out of blocks");
 }
 
+// 分配一个清零过的磁盘块
+static uint
+balloc(uint dev)
+{
+  uint b;
+
+  b = bfind(dev);
+  bzero(dev, b);
+  return b;
+}
+
 // 释放一个磁盘块
 static void
 bfree(int dev, uint b)
@@ -97,6 +127,7 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  log_bfree(b);
 }
 
 // Inodes.
@@ -157,6 +188,7 @@ iinit()
   int i = 0;
   
   initlock(&itable.lock, "itable");
+  initlock(&orphan.lock, "orphan");
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
   }
@@ -298,9 +330,44 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// 把超级块孤儿表里值为old的一项改成new。
+// 调用者必须在事务里。找不到old返回-1。
+static int
+orphanset(uint dev, uint old, uint new)
+{
+  struct buf *bp;
+  struct superblock *s;
+  int i;
+
+  bp = bread(dev, 1);
+  s = (struct superblock*)bp->data;
+  for(i = 0; i < NORPHAN; i++){
+    if(s->orphans[i] == old){
+      s->orphans[i] = new;
+      sb.orphans[i] = new;
+      log_write(bp);
+      brelse(bp);
+      return 0;
+    }
+  }
+  brelse(bp);
+  return -1;
+}
+
+// 通知回收进程有孤儿需要截断
+void
+orphanwake(void)
+{
+  acquire(&orphan.lock);
+  orphan.pending = 1;
+  wakeup(&orphan);
+  release(&orphan.lock);
+}
+
 // 删除对内存inode的引用。
 // 如果这是最后一个引用，inode表条目可以被回收。
 // 如果这是最后一个引用，并且inode没有指向它的链接，请在磁盘上释放inode（及其内容）。
+// 有间接块的大文件记到孤儿表里，由回收进程在后台分批截断。
 // 所有对iput()的调用都必须在事务内部，以防它必须释放inode。
 void
 iput(struct inode *ip)
@@ -316,10 +383,16 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
-    itrunc(ip);
-    ip->type = 0;
-    iupdate(ip);
-    ip->valid = 0;
+    if((ip->addrs[NDIRECT] || ip->addrs[NDIRECT+1]) &&
+       orphanset(ip->dev, 0, ip->inum) == 0){
+      pcachedrop(ip->dev, ip->inum);
+      orphanwake();
+    } else {
+      itrunc(ip);
+      ip->type = 0;
+      iupdate(ip);
+      ip->valid = 0;
+    }
 
     releasesleep(&ip->lock);
 
@@ -338,21 +411,33 @@ iunlockput(struct inode *ip)
   iput(ip);
 }
 
+// 分配一个数据块，见bmap()
+static uint
+bdata(uint dev, int *fresh)
+{
+  if(fresh == 0)
+    return balloc(dev);
+  *fresh = 1;
+  return bfind(dev);
+}
+
 // Inode 内容
 //
 // 每个inode关联的内容（数据）都是存储在磁盘块中
 // 前NDIRECT块号放在ip->addrs[]，接下来的NINDIRECT块放在块ip->addrs[NDIRECT]里面
 // 返回在inode ip下第n个块的磁盘块地址
 // 如果不存在这个块，bmap会分配一个
+// fresh不为0时（有序模式的文件数据），新的数据块不经过日志清零，
+// 而是置*fresh=1，由调用者在写回原位之前清零
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, int *fresh)
 {
   uint addr, *a;
   struct buf *bp;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = bdata(ip->dev, fresh);
     return addr;
   }
   bn -= NDIRECT;
@@ -364,7 +449,7 @@ bmap(struct inode *ip, uint bn)
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+      a[bn] = addr = bdata(ip->dev, fresh);
       log_write(bp);
     }
     brelse(bp);
@@ -388,7 +473,7 @@ bmap(struct inode *ip, uint bn)
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[lev2]) == 0){
-      a[lev2] = addr = balloc(ip->dev);
+      a[lev2] = addr = bdata(ip->dev, fresh);
       log_write(bp);
     }
     brelse(bp);
@@ -407,6 +492,8 @@ itrunc(struct inode *ip)
   struct buf *bp, *bp2;
   uint *a, *a2;
 
+  pcachedrop(ip->dev, ip->inum);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -447,6 +534,122 @@ itrunc(struct inode *ip)
   iupdate(ip);
 }
 
+// 后台截断
+
+// 从间接块addr的末尾开始释放块，level是间接的层数。
+// 每释放一个块*n减一，*n为0或者日志空间不够时停下。
+// 返回1表示addr下面的块都释放完了（addr本身还没有释放）。
+static int
+bfreeind(uint dev, uint addr, int level, int *n)
+{
+  struct buf *bp;
+  uint *a;
+  int j, dirty;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  dirty = 0;
+  for(j = NINDIRECT - 1; j >= 0; j--){
+    if(a[j] == 0)
+      continue;
+    if(*n <= 0 || log_room() < ORDMETA)
+      break;
+    if(level > 1 && !bfreeind(dev, a[j], level - 1, n))
+      break;
+    bfree(dev, a[j]);
+    a[j] = 0;
+    dirty = 1;
+    (*n)--;
+  }
+  if(dirty)
+    log_write(bp);
+  brelse(bp);
+  return j < 0;
+}
+
+// 在当前事务里从文件末尾开始释放最多n个块。
+// 返回1表示所有块都释放完了。
+static int
+itruncstep(struct inode *ip, int n)
+{
+  int i;
+
+  if(ip->addrs[NDIRECT + 1]){
+    if(!bfreeind(ip->dev, ip->addrs[NDIRECT + 1], 2, &n))
+      return 0;
+    bfree(ip->dev, ip->addrs[NDIRECT + 1]);
+    ip->addrs[NDIRECT + 1] = 0;
+  }
+
+  if(ip->addrs[NDIRECT]){
+    if(!bfreeind(ip->dev, ip->addrs[NDIRECT], 1, &n))
+      return 0;
+    bfree(ip->dev, ip->addrs[NDIRECT]);
+    ip->addrs[NDIRECT] = 0;
+  }
+
+  for(i = NDIRECT - 1; i >= 0; i--){
+    if(ip->addrs[i] == 0)
+      continue;
+    if(n <= 0 || log_room() < ORDMETA)
+      return 0;
+    bfree(ip->dev, ip->addrs[i]);
+    ip->addrs[i] = 0;
+    n--;
+  }
+  return 1;
+}
+
+// 截断并释放一个孤儿inode，每个事务最多释放RECLAIMBATCH个块。
+// 每个事务提交以后磁盘上的inode都是一致的，崩溃以后从孤儿表继续。
+static void
+ireclaim(uint dev, uint inum)
+{
+  struct inode *ip;
+  int done;
+
+  ip = iget(dev, inum);
+  ilock(ip);
+  ip->size = 0;
+  do {
+    begin_op();
+    done = itruncstep(ip, RECLAIMBATCH);
+    if(done){
+      ip->type = 0;
+      orphanset(dev, inum, 0);
+    }
+    iupdate(ip);
+    end_op();
+  } while(!done);
+  ip->valid = 0;
+  iunlock(ip);
+
+  begin_op();
+  iput(ip);
+  end_op();
+}
+
+// 回收进程：等待孤儿，然后在后台截断它们
+void
+reclaimer(void)
+{
+  uint inum;
+  int i;
+
+  for(;;){
+    acquire(&orphan.lock);
+    while(orphan.pending == 0)
+      sleep(&orphan, &orphan.lock);
+    orphan.pending = 0;
+    release(&orphan.lock);
+
+    for(i = 0; i < NORPHAN; i++){
+      if((inum = sb.orphans[i]) != 0)
+        ireclaim(ROOTDEV, inum);
+    }
+  }
+}
+
 // 从inode拷贝stat信息
 // 调用者必须持有ip->lock
 void
@@ -459,23 +662,81 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// 返回普通文件ip从偏移off开始的一页内容所在的物理页，调用者持有一个引用，用完kfree()。
+// off一般是页对齐的，exec的段可以不是。文件末尾以后的部分是0。
+// 先查页缓存，没有的话从磁盘读进来放进缓存。
+// 调用者必须持有ip->lock。没有内存时返回0。
+uint64
+igetpage(struct inode *ip, uint off)
+{
+  uint64 pa;
+  uint o, m;
+  struct buf *bp;
+
+  if((pa = pcacheget(ip->dev, ip->inum, off)) != 0)
+    return pa;
+  if((pa = (uint64)kalloc()) == 0)
+    return 0;
+  memset((void*)pa, 0, PGSIZE);
+  for(o = off; o < off + PGSIZE && o < ip->size; o += m){
+    bp = bread(ip->dev, bmap(ip, o/BSIZE, 0));
+    m = min(BSIZE - o % BSIZE, min(off + PGSIZE - o, ip->size - o));
+    memmove((char*)pa + (o - off), bp->data + o % BSIZE, m);
+    brelse(bp);
+  }
+  pcacheput(ip->dev, ip->inum, off, pa);
+  return pa;
+}
+
+// 预读：把文件[off, end)所在的页读进页缓存，已经在缓存里的不用读。
+// 调用者必须持有ip->lock。
+void
+ireadahead(struct inode *ip, uint off, uint end)
+{
+  uint64 pa;
+
+  if(ip->type != T_FILE)
+    return;
+  for(off = PGROUNDDOWN(off); off < end && off < ip->size; off += PGSIZE){
+    if((pa = igetpage(ip, off)) == 0)
+      break;
+    kfree((void*)pa);
+  }
+}
+
 // 从inode读取数据
 // 调用者必须持有ip->locl
 // 如果user_dst==1 则dst是个用户虚拟地址
 // 否则dst就是内核地址
+// 普通文件从页缓存读，没有内存时退回到逐块读
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  uint64 pa;
+  int r;
 
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+  tot = 0;
+  if(ip->type == T_FILE){
+    for(; tot<n; tot+=m, off+=m, dst+=m){
+      if((pa = igetpage(ip, PGROUNDDOWN(off))) == 0)
+        break;
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      r = either_copyout(user_dst, dst, (char*)pa + (off % PGSIZE), m);
+      kfree((void*)pa);
+      if(r == -1)
+        return -1;
+    }
+  }
+
+  for(; tot<n; tot+=m, off+=m, dst+=m){
+    bp = bread(ip->dev, bmap(ip, off/BSIZE, 0));
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
@@ -492,12 +753,14 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 // 如果user_src==1 则src是个用户虚拟地址
 // 否则src就是内核地址
 // 返回成功写入字节数
-// 如果返回值小于请求的数量n
-// 那肯定有错误发生
+// 普通文件使用有序模式：数据块直接写回原位，只有元数据进日志，
+// 当前事务的日志空间不够时提前返回，剩下的由调用者放到下一个事务。
+// 其它情况下返回值小于请求的数量n说明有错误发生
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, bno;
+  int ordered, fresh;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -505,14 +768,25 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  ordered = (ip->type == T_FILE);
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if(ordered && log_room() < ORDMETA)
+      break;
+    fresh = 0;
+    bno = bmap(ip, off/BSIZE, ordered ? &fresh : 0);
+    bp = fresh ? bclear(ip->dev, bno) : bread(ip->dev, bno);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+      if(fresh)
+        bwrite(bp);  // 新块已经挂到inode上了，不能留下旧内容
       brelse(bp);
       break;
     }
-    log_write(bp);
+    if(ordered){
+      bwrite(bp);
+      pcachewrite(ip->dev, ip->inum, off, bp->data + (off % BSIZE), m);
+    } else
+      log_write(bp);
     brelse(bp);
   }
 
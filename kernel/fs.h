@@ -3,6 +3,7 @@
 
 #define ROOTINO  1   // 根inode号 
 #define BSIZE 1024  // 块大小
+#define NORPHAN 16  // 超级块里孤儿表的大小
 
 // 磁盘布局:
 // [ 引导块 | 超级块 | 日志 | inode 块 | 空闲位图 | 数据块]
@@ -18,6 +19,7 @@ struct superblock {
   uint logstart;     // 第一个日志块的块号
   uint inodestart;   // 第一个inode块的块号
   uint bmapstart;    // 第一个空闲位图块的块号
+  uint orphans[NORPHAN]; // 等待后台截断的inode号（0表示空）
 };
 
 #define FSMAGIC 0x10203040
@@ -0,0 +1,149 @@
+// futex：在用户内存的一个字上睡眠和唤醒。
+//
+// 等待的进程按字的键挂在一个哈希表里。私有内存的键是(地址空间, 虚拟地址)，
+// 同一个进程的线程之间用；fork()以后写时拷贝给一方换了物理页也不影响。
+// MAP_SHARED的内存的键是物理地址，所以通过它共享同一页的不同进程也能互相唤醒。
+// 查键和读字的值的时候拿着mm->lock，写时拷贝不会在中间换掉页。
+//
+// FUTEX_WAIT在桶的锁里比较字的值再睡眠，FUTEX_WAKE也要拿这个锁，
+// 所以先改值再唤醒的一方不会错过正在进入等待的进程。
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fcntl.h"
+
+#define NFUTEXHASH 31
+
+struct futexkey {
+  struct mm *mm;      // 私有内存：地址空间；MAP_SHARED的内存是0
+  uint64 addr;        // 私有内存：虚拟地址；MAP_SHARED的内存：物理地址
+};
+
+// 一个等待的进程，在它的内核栈上
+struct futexwait {
+  struct futexkey key;
+  int woken;
+  struct futexwait *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct futexwait *head;
+} futexhash[NFUTEXHASH];
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NFUTEXHASH; i++)
+    initlock(&futexhash[i].lock, "futex");
+}
+
+static int
+futexhashkey(struct futexkey *k)
+{
+  return (k->addr ^ (uint64)k->mm) % NFUTEXHASH;
+}
+
+// 算出用户地址addr的键，返回字的物理地址。没有映射或者是写时拷贝的页
+// 先当写缺页处理。addr要4字节对齐；不能写的话返回0。
+// 成功时持有p->mm->lock，调用者读完值以后释放。
+static uint64
+futexaddr(struct proc *p, uint64 addr, struct futexkey *k)
+{
+  struct vma *v;
+  pte_t *pte;
+  uint64 pa;
+
+  if(addr % sizeof(uint32) != 0 || addr >= MAXVA)
+    return 0;
+  acquiresleep(&p->mm->lock);
+  pte = walk(p->pagetable, addr, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_C)){
+    if(uvmfault(p, addr, 1) < 0)
+      goto bad;
+    pte = walk(p->pagetable, addr, 0);
+  }
+  if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W))
+    goto bad;
+  pa = PTE2PA(*pte) + (addr % PGSIZE);
+  if((v = vmalookup(p->mm->vmas, addr)) != 0 && (v->flags & MAP_SHARED)){
+    k->mm = 0;
+    k->addr = pa;
+  } else {
+    k->mm = p->mm;
+    k->addr = addr;
+  }
+  return pa;
+
+bad:
+  releasesleep(&p->mm->lock);
+  return 0;
+}
+
+// addr处的值还是val的话睡眠，直到被futexwake()唤醒。
+// 值已经变了、地址不对或者进程被杀死时返回-1。
+int
+futexwait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct futexwait w, **wp;
+  uint64 pa;
+  int h;
+
+  if((pa = futexaddr(p, addr, &w.key)) == 0)
+    return -1;
+  h = futexhashkey(&w.key);
+  acquire(&futexhash[h].lock);
+  if(*(volatile int*)pa != val){
+    release(&futexhash[h].lock);
+    releasesleep(&p->mm->lock);
+    return -1;
+  }
+  w.woken = 0;
+  w.next = futexhash[h].head;
+  futexhash[h].head = &w;
+  releasesleep(&p->mm->lock);
+  while(!w.woken && !p->killed)
+    sleep(&w, &futexhash[h].lock);
+  if(!w.woken){
+    for(wp = &futexhash[h].head; *wp != &w; wp = &(*wp)->next)
+      ;
+    *wp = w.next;
+  }
+  release(&futexhash[h].lock);
+  return w.woken ? 0 : -1;
+}
+
+// 唤醒最多n个在addr上等待的进程，返回唤醒的个数
+int
+futexwake(uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct futexwait *w, **wp;
+  struct futexkey k;
+  int h, woken = 0;
+
+  if(futexaddr(p, addr, &k) == 0)
+    return -1;
+  releasesleep(&p->mm->lock);
+  h = futexhashkey(&k);
+  acquire(&futexhash[h].lock);
+  for(wp = &futexhash[h].head; (w = *wp) != 0 && woken < n; ){
+    if(w->key.mm != k.mm || w->key.addr != k.addr){
+      wp = &w->next;
+      continue;
+    }
+    *wp = w->next;
+    w->woken = 1;
+    wakeup(w);
+    woken++;
+  }
+  release(&futexhash[h].lock);
+  return woken;
+}
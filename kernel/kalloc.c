@@ -12,6 +12,10 @@ void freerange(void *pa_start, void *pa_end);
 extern char end[]; // 内核后面的第一个地址
                    // 由kernel.ld定义
 
+// 全局只读的零页。懒分配的内存第一次被读的时候映射这一页（带PTE_C），
+// 写的时候再复制。内核自己一直持有一个引用，所以它永远不会被释放。
+char *zeropage;
+
 struct run {
   struct run *next;
 };
@@ -34,6 +38,9 @@ kinit()
     initlock(&kmem[i].lock, "kmem");
   initlock(&refcnt.lock, "refcnt");
   freerange(end, (void*)PHYSTOP);
+  if((zeropage = kalloc()) == 0)
+    panic("kinit");
+  memset(zeropage, 0, PGSIZE);
 }
 
 void
@@ -78,10 +85,9 @@ kfree(void *pa)
   release(&kmem[cpu_id].lock);
 }
 
-// 分配一个4096字节的物理内存页，返回一个指针给内核
-// 返回0代表没办法分配内存了
-void *
-kalloc(void)
+// 从本CPU的空闲链表取一页，没有的话从别的CPU偷一页
+static struct run *
+kpop(void)
 {
   struct run *r;
 
@@ -103,6 +109,20 @@ kalloc(void)
           } else release(&kmem[i].lock);
       }
   }
+  return r;
+}
+
+// 分配一个4096字节的物理内存页，返回一个指针给内核
+// 返回0代表没办法分配内存了
+void *
+kalloc(void)
+{
+  struct run *r;
+
+  // 没有空闲页的时候回收页缓存里没有被映射的页再试
+  while((r = kpop()) == 0)
+    if(pcachereclaim(32) == 0)
+      break;
 
   if(r)
     memset((char*)r, 5, PGSIZE); // 填充垃圾数据
@@ -135,4 +155,14 @@ void kref(uint64 pa) {
       refcnt.a[(pa - KERNBASE) >> PGSHIFT]++;
       release(&refcnt.lock);
   }
-}
\ No newline at end of file
+}
+// 返回物理页pa的引用计数
+int krefcnt(uint64 pa) {
+  int n = 0;
+  if (pa >= KERNBASE) {
+      acquire(&refcnt.lock);
+      n = refcnt.a[(pa - KERNBASE) >> PGSHIFT];
+      release(&refcnt.lock);
+  }
+  return n;
+}
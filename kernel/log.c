@@ -4,6 +4,7 @@
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
 
@@ -45,6 +46,12 @@ struct log {
 };
 struct log log;
 
+// 本事务中释放的块（位图）。有序模式下文件数据直接写回原位，
+// 这些块在提交之前不能再分配出去，否则崩溃恢复时旧的内容
+// （比如被释放的间接块）可能已经被新数据覆盖。
+static uchar freed[FSSIZE/8 + 1];
+static int nfreed;
+
 static void recover_from_log(void);
 static void commit();
 
@@ -131,6 +138,7 @@ begin_op(void)
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      myproc()->nlogged = 0;
       release(&log.lock);
       break;
     }
@@ -194,6 +202,10 @@ commit()
     log.lh.n = 0;
     write_head();    // 从日志中删除事务
   }
+  if(nfreed){
+    memset(freed, 0, sizeof(freed));
+    nfreed = 0;
+  }
 }
 
 // 调用者已经修改了b->data，并用缓冲区完成了。
@@ -224,7 +236,51 @@ log_write(struct buf *b)
   if (i == log.lh.n) {  // 向日志添加新块?
     bpin(b);
     log.lh.n++;
+    myproc()->nlogged++;
   }
   release(&log.lock);
 }
 
+// 记录块b在当前事务中被释放了。
+void
+log_bfree(uint b)
+{
+  acquire(&log.lock);
+  freed[b/8] |= 1 << (b%8);
+  nfreed++;
+  release(&log.lock);
+}
+
+// 块b是否在当前事务中被释放？
+int
+log_bfreed(uint b)
+{
+  int r;
+
+  acquire(&log.lock);
+  r = (freed[b/8] & (1 << (b%8))) != 0;
+  release(&log.lock);
+  return r;
+}
+
+// 有序模式的writei()在当前事务中还能记录多少个块？
+// 调用者只能用自己的MAXOPBLOCKS，只算它自己新加到日志里的块，
+// 除非它是唯一进行中的FS系统调用，
+// 这时候它可以用完整个日志（新的begin_op()会等待）。
+int
+log_room(void)
+{
+  int n;
+
+  acquire(&log.lock);
+  if(log.outstanding == 1){
+    n = LOGSIZE;
+    if(log.size - 1 < n)
+      n = log.size - 1;
+    n -= log.lh.n;
+  } else {
+    n = MAXOPBLOCKS - myproc()->nlogged;
+  }
+  release(&log.lock);
+  return n;
+}
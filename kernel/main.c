@@ -11,15 +11,18 @@ void
 main()
 {
   if(cpuid() == 0){
+    // 设备寄存器只映射在DEVBASE上面，要先启用分页才能用console
+    kinit();         // 物理页分配器
+    kmallocinit();   // 小对象分配器
+    kvminit();       // 创建内核页表
+    kvminithart();   // 启用分页
+    asidinit();      // ASID分配器
     consoleinit();
     statsinit();
     printfinit();
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
-    kinit();         // 物理页分配器
-    kvminit();       // 创建内核页表
-    kvminithart();   // 启用分页
     procinit();      // 进程表
     trapinit();      // 陷阱向量
     trapinithart();  // 安装内核陷阱向量
@@ -27,19 +30,25 @@ main()
     plicinithart();  // 向PLIC配置设备中断
     binit();         // 缓冲区缓存
     iinit();         // inode缓存
+    pcacheinit();    // 页缓存
+    vmainit();       // mmap区域
+    futexinit();     // futex的等待表
     fileinit();      // 文件表
+    pipeinit();      // 管道
     virtio_disk_init(); // 模拟硬盘
+    mbufinit();      // 包缓存
     pci_init();      // 初始化pci
     sockinit();      // 初始化套接字
     userinit();      // 第一个用户进程
+    kproc(reclaimer, "reclaimer"); // 后台截断孤儿文件
     __sync_synchronize();
     started = 1;
   } else {
     while(started == 0)
       ;
     __sync_synchronize();
-    printf("hart %d starting\n", cpuid());
     kvminithart();    // 启用分页
+    printf("hart %d starting\n", cpuid());
     trapinithart();   // 安装内核陷阱向量
     plicinithart();   // 向PLIC配置设备中断
   }
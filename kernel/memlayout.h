@@ -17,14 +17,24 @@
 // end -- 内核页分配区域开始的地方
 // PHYSTOP -- 内核可用内存结束的地方
 
+// 内核直接用进程自己的页表运行，每个进程的页表里都有[KERNBASE, KVMTOP)的内核映射。
+// 设备寄存器不在原来的物理地址映射，而是映射到DEVBASE + 物理地址，
+// 这样[0, KERNBASE)都可以给用户用。
+#define DEVBASE 0xC0000000L
+#define KVMTOP  (DEVBASE + 0x80000000L)
+
 // qemu 放 UART 寄存器 到下面的内存地址.
-#define UART0 0x10000000L
+#define UART0 (DEVBASE + 0x10000000L)
 #define UART0_IRQ 10
 
 // virtio mmio 接口
-#define VIRTIO0 0x10001000
+#define VIRTIO0 (DEVBASE + 0x10001000L)
 #define VIRTIO0_IRQ 1
 
+// PCI-E ECAM（配置空间）和pci.c放e1000寄存器的物理地址
+#define ECAM_PA  0x30000000L
+#define E1000_PA 0x40000000L
+
 #define E1000_IRQ 33
 
 // 核心本地中断器（CLINT），它包含计时器。
@@ -33,7 +43,7 @@
 #define CLINT_MTIME (CLINT + 0xBFF8) // 自引导开始后的周期数.
 
 // qemu把平台级中断控制器（PLIC）放在这里。
-#define PLIC 0x0c000000L
+#define PLIC (DEVBASE + 0x0c000000L)
 #define PLIC_PRIORITY (PLIC + 0x0)
 #define PLIC_PENDING (PLIC + 0x1000)
 #define PLIC_MENABLE(hart) (PLIC + 0x2000 + (hart)*0x100)
@@ -51,16 +61,27 @@
 // 将trampoline页映射到用户和内核空间中的最高地址。
 #define TRAMPOLINE (MAXVA - PGSIZE)
 
-// //映射trampoline下面的内核堆栈，每个堆栈都被无效的保护页包围。
-#define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
+// 内核栈映射在KVMTOP下面，每个堆栈都被无效的保护页包围。
+// 它们在共享的内核映射里，所以任何进程的页表上都能用任何进程的内核栈，
+// 进程之间可以直接切换（见sched()）。
+#define KSTACK(p) (KVMTOP - ((p)+1)* 2*PGSIZE)
 
 // 用户内存布局。
 // 地址从0开始:
 //   代码
 //   原始数据和bss
 //   固定大小的栈
-//   可扩展堆
+//   可扩展堆（碰到[KERNBASE, KVMTOP)就不能用了）
 //   ...
+//   mmap区域
+//   线程的trapframe
 //   TRAPFRAME (p->trapframe, trampoline使用)
 //   TRAMPOLINE (与内核中的页相同)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// clone()出来的线程和别人共享页表，trapframe按进程表里的下标p映射在TRAPFRAME下面
+#define THREADFRAME(p) (TRAPFRAME - ((p)+1)*PGSIZE)
+
+// mmap()在[MMAPBASE, MMAPTOP)里分配地址
+#define MMAPBASE (1L << 37)
+#define MMAPTOP (MAXVA - (1L << 21))
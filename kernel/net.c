@@ -8,6 +8,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "net.h"
 #include "defs.h"
@@ -62,22 +63,95 @@ mbuftrim(struct mbuf *m, unsigned int len)
   return m->head + m->len;
 }
 
+// 包缓存池。启动时分配NMBUF个，一页一个（e1000按物理地址DMA，不能跨页）。
+// 每个CPU有自己的空闲链表，空了从全局链表成批地拿，多了成批地还回去；
+// 操作本CPU的链表时关中断，所以e1000的中断处理函数里也能分配。
+// 分配时不清零，用的人自己填头部和数据。
+#define NMBUF 256
+#define MBUFBATCH 8
+#define MBUFCPUMAX (2*MBUFBATCH)
+
+static struct {
+  struct spinlock lock;
+  struct mbuf *free;        // 全局空闲链表
+  struct {
+    struct mbuf *free;
+    int n;
+  } __attribute__((aligned(64))) cpu[NCPU];
+  int inuse;                // 在用的个数
+  int highwater;            // inuse的最大值
+  int nfail;                // 没分配到的次数
+} mbufpool;
+
+void
+mbufinit(void)
+{
+  struct mbuf *m;
+
+  initlock(&mbufpool.lock, "mbufpool");
+  for (int i = 0; i < NMBUF; i++) {
+    if ((m = kalloc()) == 0)
+      panic("mbufinit");
+    m->next = mbufpool.free;
+    mbufpool.free = m;
+  }
+}
+
+// Allocates up to n packet buffers into ms[], returns how many it got.
+// 一次分配最多n个包缓存放在ms[]里，返回分配到的个数
+int
+mbufallocn(struct mbuf **ms, int n, unsigned int headroom)
+{
+  struct mbuf *m;
+  int got = 0, c, v, h;
+
+  if (headroom > MBUF_SIZE)
+    return 0;
+  push_off();
+  c = cpuid();
+  while (got < n) {
+    if (mbufpool.cpu[c].free == 0) {
+      acquire(&mbufpool.lock);
+      for (int i = 0; i < MBUFBATCH && mbufpool.free; i++) {
+        m = mbufpool.free;
+        mbufpool.free = m->next;
+        m->next = mbufpool.cpu[c].free;
+        mbufpool.cpu[c].free = m;
+        mbufpool.cpu[c].n++;
+      }
+      release(&mbufpool.lock);
+      if (mbufpool.cpu[c].free == 0)
+        break;
+    }
+    m = mbufpool.cpu[c].free;
+    mbufpool.cpu[c].free = m->next;
+    mbufpool.cpu[c].n--;
+    m->next = 0;
+    m->head = (char *)m->buf + headroom;
+    m->len = 0;
+    ms[got++] = m;
+  }
+  pop_off();
+
+  if (got < n)
+    __atomic_add_fetch(&mbufpool.nfail, 1, __ATOMIC_RELAXED);
+  v = __atomic_add_fetch(&mbufpool.inuse, got, __ATOMIC_RELAXED);
+  h = __atomic_load_n(&mbufpool.highwater, __ATOMIC_RELAXED);
+  while (h < v && !__atomic_compare_exchange_n(&mbufpool.highwater, &h, v, 0,
+                                               __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  return got;
+}
+
 // Allocates a packet buffer.
 // 分配一个包缓存
 struct mbuf *
 mbufalloc(unsigned int headroom)
 {
   struct mbuf *m;
- 
-  if (headroom > MBUF_SIZE)
-    return 0;
-  m = kalloc();
-  if (m == 0)
+
+  if (mbufallocn(&m, 1, headroom) == 0)
     return 0;
-  m->next = 0;
-  m->head = (char *)m->buf + headroom;
-  m->len = 0;
-  memset(m->buf, 0, sizeof(m->buf));
   return m;
 }
 
@@ -86,7 +160,33 @@ mbufalloc(unsigned int headroom)
 void
 mbuffree(struct mbuf *m)
 {
-  kfree(m);
+  int c;
+
+  push_off();
+  c = cpuid();
+  m->next = mbufpool.cpu[c].free;
+  mbufpool.cpu[c].free = m;
+  if (++mbufpool.cpu[c].n > MBUFCPUMAX) {
+    acquire(&mbufpool.lock);
+    for (int i = 0; i < MBUFBATCH; i++) {
+      m = mbufpool.cpu[c].free;
+      mbufpool.cpu[c].free = m->next;
+      mbufpool.cpu[c].n--;
+      m->next = mbufpool.free;
+      mbufpool.free = m;
+    }
+    release(&mbufpool.lock);
+  }
+  pop_off();
+  __atomic_sub_fetch(&mbufpool.inuse, 1, __ATOMIC_RELAXED);
+}
+
+// 给stats设备
+int
+statsmbuf(char *buf, int sz)
+{
+  return snprintf(buf, sz, "--- mbuf: total %d inuse %d highwater %d allocfail %d\n",
+                  NMBUF, mbufpool.inuse, mbufpool.highwater, mbufpool.nfail);
 }
 
 // Pushes an mbuf to the end of the queue.
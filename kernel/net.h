@@ -31,6 +31,7 @@ char *mbuftrim(struct mbuf *m, unsigned int len);
 #define mbuftrimhdr(mbuf, hdr) (typeof(hdr)*)mbuftrim(mbuf, sizeof(hdr))
 
 struct mbuf *mbufalloc(unsigned int headroom);
+int mbufallocn(struct mbuf **ms, int n, unsigned int headroom);
 void mbuffree(struct mbuf *m);
 
 struct mbufq {
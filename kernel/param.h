@@ -6,8 +6,13 @@
 #define NDEV         10  // 最大主设备编号
 #define ROOTDEV       1  // 文件系统根磁盘的设备号
 #define MAXARG       32  // 最大exec参数数
+#define NSPAWNFD      3  // spawn()给子进程指定的文件描述符数
 #define MAXOPBLOCKS  10  // 任何文件系统操作写入的最大块数
 #define LOGSIZE      (MAXOPBLOCKS*3)  // 磁盘日志中的最大数据块
 #define NBUF         (MAXOPBLOCKS*3)  // 磁盘块缓存大小
+#define NPCACHE      512  // 页缓存最多缓存的页数
+#define FAULTAROUND  8    // 一次缺页最多映射的页数（包括缺页的那一页）
+#define READAHEAD    4    // read()顺序读的时候预读的页数
 #define FSSIZE       200000  // 文件系统的大小（以块为单位）
+#define RECLAIMBATCH 128   // 后台截断每个事务最多释放的块数
 #define MAXPATH      128   // 最大文件路径名
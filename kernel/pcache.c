@@ -0,0 +1,237 @@
+// 页缓存(page cache)。
+//
+// 按(dev, inum, 文件偏移)缓存普通文件内容的物理页，readi()、mmap
+// 和exec缺页都从这里取页。缓存自己持有每一页的一个引用（kalloc.c的引用计数），
+// 映射直接映射缓存页，再各自持有一个引用。
+//
+// 页一般是页对齐的。exec的段在文件里不是页对齐的，它们的页按段里的偏移缓存，
+// 这样执行同一个程序的进程共享代码页。不对齐的页和它开头所在的那一页散列到
+// 同一条链上，文件被写的时候从这两条链上丢掉和写的范围重叠的不对齐的页。
+//
+// 接口：
+//* pcacheget查找一页，找到的话给调用者加一个引用。
+//* pcacheput把调用者填好的页放进缓存。
+//* writei()用pcachewrite更新缓存里的页，截断的时候用pcachedrop丢弃。
+//* fadvise()用pcacheevict丢弃不再需要的页。
+//* kalloc()没有内存时调用pcachereclaim回收没有被映射的页。
+//
+// 一个inode的页只在持有它的ilock时填充、修改和丢弃；
+// 只有引用计数为1（只有缓存自己在用）的页会被回收。
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define PCHASH 61
+
+struct pcpage {
+  uint dev;
+  uint inum;            // 0表示空闲
+  uint off;             // 页在文件里的偏移
+  int used;             // 最近被访问过，时钟算法用
+  uint64 pa;
+  struct pcpage *next;  // 哈希链
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+  struct pcpage *hash[PCHASH];
+  int hand;             // 时钟算法的指针
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// 按off所在的页散列
+static uint
+phash(uint dev, uint inum, uint off)
+{
+  return (dev + inum * 31 + off / PGSIZE) % PCHASH;
+}
+
+// 调用者必须持有pcache.lock
+static struct pcpage*
+plookup(uint dev, uint inum, uint off)
+{
+  struct pcpage *pp;
+
+  for(pp = pcache.hash[phash(dev, inum, off)]; pp; pp = pp->next)
+    if(pp->dev == dev && pp->inum == inum && pp->off == off)
+      return pp;
+  return 0;
+}
+
+// 从哈希链上摘下pp并释放缓存持有的引用。
+// 调用者必须持有pcache.lock
+static void
+premove(struct pcpage *pp)
+{
+  struct pcpage **pq;
+
+  for(pq = &pcache.hash[phash(pp->dev, pp->inum, pp->off)]; *pq != pp; pq = &(*pq)->next)
+    ;
+  *pq = pp->next;
+  kfree((void*)pp->pa);
+  pp->inum = 0;
+  pp->pa = 0;
+}
+
+// 用时钟算法找一个可以回收的页（没有被映射，最近没有被访问）。
+// 调用者必须持有pcache.lock
+static struct pcpage*
+pvictim(void)
+{
+  struct pcpage *pp;
+  int i;
+
+  for(i = 0; i < 2 * NPCACHE; i++){
+    pp = &pcache.page[pcache.hand];
+    pcache.hand = (pcache.hand + 1) % NPCACHE;
+    if(pp->inum == 0 || krefcnt(pp->pa) > 1)
+      continue;
+    if(pp->used){
+      pp->used = 0;
+      continue;
+    }
+    return pp;
+  }
+  return 0;
+}
+
+// 查找(dev, inum)从文件偏移off开始的一页。
+// 找到的话增加引用计数并返回物理地址，调用者用完kfree()，否则返回0。
+uint64
+pcacheget(uint dev, uint inum, uint off)
+{
+  struct pcpage *pp;
+  uint64 pa;
+
+  acquire(&pcache.lock);
+  pa = 0;
+  if((pp = plookup(dev, inum, off)) != 0){
+    pp->used = 1;
+    pa = pp->pa;
+    kref(pa);
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// 把调用者填好的页pa放进缓存，缓存另外持有一个引用。
+// 缓存满了并且没有可以回收的页时就不缓存。
+void
+pcacheput(uint dev, uint inum, uint off, uint64 pa)
+{
+  struct pcpage *pp;
+  uint h;
+
+  acquire(&pcache.lock);
+  if(plookup(dev, inum, off)){
+    release(&pcache.lock);
+    return;
+  }
+  for(pp = pcache.page; pp < &pcache.page[NPCACHE]; pp++)
+    if(pp->inum == 0)
+      break;
+  if(pp == &pcache.page[NPCACHE]){
+    if((pp = pvictim()) == 0){
+      release(&pcache.lock);
+      return;
+    }
+    premove(pp);
+  }
+  pp->dev = dev;
+  pp->inum = inum;
+  pp->off = off;
+  pp->used = 1;
+  pp->pa = pa;
+  kref(pa);
+  h = phash(dev, inum, off);
+  pp->next = pcache.hash[h];
+  pcache.hash[h] = pp;
+  release(&pcache.lock);
+}
+
+// 丢掉从文件第pg页里开始、和[off, off+n)重叠的不对齐的页。
+// 调用者必须持有pcache.lock
+static void
+pdropunaligned(uint dev, uint inum, uint pg, uint off, uint n)
+{
+  struct pcpage *pp, *next;
+
+  for(pp = pcache.hash[phash(dev, inum, pg)]; pp; pp = next){
+    next = pp->next;
+    if(pp->dev == dev && pp->inum == inum && pp->off % PGSIZE &&
+       pp->off < off + n && off < pp->off + PGSIZE)
+      premove(pp);
+  }
+}
+
+// 文件偏移off处的n个字节被改成了src（内核地址），如果那一页
+// 在缓存里就跟着更新，和它重叠的不对齐的页丢掉。[off, off+n)不能跨页。
+void
+pcachewrite(uint dev, uint inum, uint off, void *src, uint n)
+{
+  struct pcpage *pp;
+  uint pg = PGROUNDDOWN(off);
+
+  acquire(&pcache.lock);
+  if((pp = plookup(dev, inum, pg)) != 0)
+    memmove((char*)pp->pa + off % PGSIZE, src, n);
+  // 重叠的不对齐的页从这一页或者前一页里开始
+  pdropunaligned(dev, inum, pg, off, n);
+  if(pg >= PGSIZE)
+    pdropunaligned(dev, inum, pg - PGSIZE, off, n);
+  release(&pcache.lock);
+}
+
+// 丢弃(dev, inum)的所有缓存页。
+// 已经被映射的页由映射继续持有。
+void
+pcachedrop(uint dev, uint inum)
+{
+  struct pcpage *pp;
+
+  acquire(&pcache.lock);
+  for(pp = pcache.page; pp < &pcache.page[NPCACHE]; pp++)
+    if(pp->inum == inum && pp->dev == dev)
+      premove(pp);
+  release(&pcache.lock);
+}
+
+// 丢弃(dev, inum)整个落在文件[start, end)里的没有被映射的缓存页（POSIX_FADV_DONTNEED）
+void
+pcacheevict(uint dev, uint inum, uint start, uint end)
+{
+  struct pcpage *pp;
+
+  acquire(&pcache.lock);
+  for(pp = pcache.page; pp < &pcache.page[NPCACHE]; pp++)
+    if(pp->inum == inum && pp->dev == dev && pp->off >= start && pp->off + PGSIZE <= end &&
+       krefcnt(pp->pa) == 1)
+      premove(pp);
+  release(&pcache.lock);
+}
+
+// 回收最多n个没有被映射的缓存页，返回回收的页数
+int
+pcachereclaim(int n)
+{
+  struct pcpage *pp;
+  int i;
+
+  acquire(&pcache.lock);
+  for(i = 0; i < n; i++){
+    if((pp = pvictim()) == 0)
+      break;
+    premove(pp);
+  }
+  release(&pcache.lock);
+  return i;
+}
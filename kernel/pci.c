@@ -8,19 +8,20 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
 
 void
 pci_init()
 {
-  // we'll place the e1000 registers at this address.
-  // vm.c maps this range.
-  uint64 e1000_regs = 0x40000000L;
+  // we'll place the e1000 registers at this physical address.
+  // vm.c maps this range at DEVBASE + E1000_PA.
+  uint64 e1000_regs = E1000_PA;
 
   // qemu -machine virt puts PCIe config space here.
-  // vm.c maps this range.
-  uint32  *ecam = (uint32 *) 0x30000000L;
+  // vm.c maps this range at DEVBASE + ECAM_PA.
+  uint32  *ecam = (uint32 *) (DEVBASE + ECAM_PA);
   
   // look at each possible PCI device on bus 0.
   for(int dev = 0; dev < 32; dev++){
@@ -55,7 +56,7 @@ pci_init()
       // physical address 0x40000000.
       base[4+0] = e1000_regs;
 
-      e1000_init((uint32*)e1000_regs);
+      e1000_init((uint32*)(DEVBASE + e1000_regs));
     }
   }
 }
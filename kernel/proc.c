@@ -19,7 +19,14 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// 地址空间，每个至少有一个进程在用，所以NPROC个就够了
+struct {
+  struct spinlock lock;        // 保护ref和live
+  struct mm mm[NPROC];
+} mmtable;
+
 extern void forkret(void);
+static void kprocret(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
@@ -41,9 +48,8 @@ proc_mapstacks(pagetable_t kpgtbl) {
     char *pa = kalloc();
     if(pa == 0)
       panic("kalloc");
-    p->kstackpa = pa;
     uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W | PTE_G);
   }
 }
 
@@ -55,6 +61,9 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  initlock(&mmtable.lock, "mmtable");
+  for(struct mm *mm = mmtable.mm; mm < &mmtable.mm[NPROC]; mm++)
+    initsleeplock(&mm->lock, "mm");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->kstack = KSTACK((int) (p - proc));
@@ -102,12 +111,72 @@ allocpid() {
   return pid;
 }
 
+// 分配一个空的地址空间，没有的话返回0
+struct mm*
+mmalloc(void)
+{
+  struct mm *mm;
+
+  acquire(&mmtable.lock);
+  for(mm = mmtable.mm; mm < &mmtable.mm[NPROC]; mm++){
+    if(mm->ref == 0){
+      mm->ref = 1;
+      mm->live = 1;
+      mm->sz = 0;
+      mm->vmas = 0;
+      mm->heapadv = 0;  // MADV_NORMAL
+      mm->asid = 0;
+      mm->stale = 0;
+      release(&mmtable.lock);
+      return mm;
+    }
+  }
+  release(&mmtable.lock);
+  return 0;
+}
+
+// 一个用mm的进程exit()或者exec()了。
+// 返回1表示它是最后一个，调用者要解除所有映射（别的进程都是僵尸了）
+int
+mmleave(struct mm *mm)
+{
+  int last;
+
+  acquire(&mmtable.lock);
+  last = --mm->live == 0;
+  release(&mmtable.lock);
+  return last;
+}
+
+// 一个进程不再用地址空间mm了：从它的页表pagetable里去掉这个进程的trapframe
+// （映射在trapframeva），最后一个用mm的进程释放整个页表。pagetable可以是0。
+void
+mmput(struct mm *mm, pagetable_t pagetable, uint64 trapframeva)
+{
+  int last;
+
+  if(pagetable)
+    uvmunmap(pagetable, trapframeva, 1, 0);
+  acquire(&mmtable.lock);
+  last = --mm->ref == 0;
+  release(&mmtable.lock);
+  if(last){
+    if(pagetable)
+      proc_freepagetable(pagetable, mm->sz);
+  } else {
+    // 以后别的线程的trapframe可能映射在同一个地址，
+    // 所有hart上的旧TLB项都要在切换过来时清掉
+    __sync_fetch_and_or(&mm->stale, ~0L);
+  }
+}
+
 // 在进程表中查找未使用（UNUSED）的进程。
 // 如果找到，初始化在内核中运行所需的状态，
 // 返回时要持有p->lock锁。
+// share不是0的话新进程是share的线程，和它共享地址空间。
 // 如果没有空闲进程，或者内存分配失败，则返回0。
 static struct proc*
-allocproc(void)
+allocproc(struct proc *share)
 {
   struct proc *p;
 
@@ -132,27 +201,31 @@ found:
     return 0;
   }
 
-  // 一个空的用户页表
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
-  }
-
-  // 创建用户内核页表（lab pagetablb）
-  p->kpagetable = proc_kpagetable();
-  if (p->kpagetable == 0) {
+  if(share){
+    // 共享share的页表，trapframe映射在自己的位置。
+    // 这个页表项只有这个线程用，不用持有mm->lock
+    acquire(&mmtable.lock);
+    share->mm->ref++;
+    share->mm->live++;
+    release(&mmtable.lock);
+    p->mm = share->mm;
+    p->trapframeva = THREADFRAME((int) (p - proc));
+    if(mappages(share->pagetable, p->trapframeva, PGSIZE,
+                (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
+      mmleave(p->mm);
       freeproc(p);
       release(&p->lock);
       return 0;
-  }
-
-  if (mappages(p->kpagetable, (uint64)p->kstack, PGSIZE,
-               (uint64)p->kstackpa, PTE_R | PTE_W) != 0) {
+    }
+    p->pagetable = share->pagetable;
+  } else {
+    // 一个空的用户页表
+    if((p->mm = mmalloc()) == 0 || (p->pagetable = proc_pagetable(p)) == 0){
       freeproc(p);
       release(&p->lock);
       return 0;
+    }
+    p->trapframeva = TRAPFRAME;
   }
 
   p->duration = p->ticks = 0;
@@ -174,13 +247,10 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz, p->mmapsz);
+  if(p->mm)
+    mmput(p->mm, p->pagetable, p->trapframeva);
+  p->mm = 0;
   p->pagetable = 0;
-  if (p->kpagetable)
-    proc_kfreepagetable(p->kpagetable);
-  p->kpagetable = 0;
-  p->sz = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -188,8 +258,6 @@ freeproc(struct proc *p)
   p->killed = 0;
   p->xstate = 0;
   p->state = UNUSED;
-  p->mmapsz = 0;
-  for (int i = 0; i < 16; i++) p->vmas[i].valid = 0;
 }
 
 // 为给定进程创建用户页表，
@@ -220,17 +288,18 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // 内核在进程的页表上运行：共享内核的映射，包括所有的内核栈
+  uvmkmap(pagetable);
+
   return pagetable;
 }
 
 // 释放进程的页表，然后释放
-// 它所指的物理内存。
+// 它所指的物理内存。trapframe由调用者先去掉（见mmput()）。
 void
-proc_freepagetable(pagetable_t pagetable, uint64 sz, uint64 mmapsz)
+proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-  uvmunmap(pagetable, TRAPFRAME, 1, 0);
-  uvmunmap(pagetable, 1L << 37, mmapsz >> PGSHIFT, 1);
   uvmfree(pagetable, sz);
 }
 
@@ -252,12 +321,12 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // 分配一个用户页并将init的指令和数据复制到其中。
   uvminit(p->pagetable, initcode, sizeof(initcode));
-  p->sz = PGSIZE;
+  p->mm->sz = PGSIZE;
 
 
   // 准备从内核到用户的第一次“返回”。
@@ -272,24 +341,43 @@ userinit(void)
   release(&p->lock);
 }
 
+// 创建一个只在内核里运行fn的进程，fn不能返回
+void
+kproc(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc(0)) == 0)
+    panic("kproc");
+  p->kfn = fn;
+  p->context.ra = (uint64)kprocret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // 将用户内存增加或减少n字节。
-// 成功时返回0，失败时返回-1。
+// 成功时返回0，失败时返回-1。调用者持有p->mm->lock。
 int
 growproc(int n)
 {
   uint sz;
   struct proc *p = myproc();
 
-  sz = p->sz;
+  sz = p->mm->sz;
   if(n > 0){
     if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
       return -1;
     }
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
-    kvmdealloc(p->kpagetable, p->sz, p->sz + n);
+    // 缩到exec的段里的话截短它们
+    if(PGROUNDUP(sz) < PGROUNDUP(p->mm->sz))
+      vmaunmap(p, PGROUNDUP(sz), PGROUNDUP(p->mm->sz) - PGROUNDUP(sz));
   }
-  p->sz = sz;
+  // 去掉的页在uvmdealloc()和vmaunmap()里已经清过TLB了，新加的映射只清这个hart
+  uvmflushhart();
+  p->mm->sz = sz;
   return 0;
 }
 
@@ -302,30 +390,41 @@ fork(void)
   struct proc *np;
   struct proc *p = myproc();
 
+  // 别的线程不能同时改地址空间。要先拿这个睡眠锁再拿np->lock
+  acquiresleep(&p->mm->lock);
+
   // 分配进程
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
+    releasesleep(&p->mm->lock);
     return -1;
   }
 
   // 从父进程拷贝用户内存到子进程
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // 父进程可写的页变成了写时拷贝，之后要清掉它的TLB项
+  if(uvmcopy(p->pagetable, np->pagetable, p->mm->sz) < 0){
+    uvmflush(p);
+    releasesleep(&p->mm->lock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
 
-  if(mmapcopy(p->pagetable, np->pagetable, p->mmapsz) < 0){
+  np->mm->sz = p->mm->sz;
+
+  if(vmafork(p, np) < 0){
+    uvmflush(p);
+    releasesleep(&p->mm->lock);
+    // 清理要用到文件系统，不能持有np->lock
+    release(&np->lock);
+    vmaunmap(np, 0, MMAPTOP);
+    acquire(&np->lock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-
-  np->sz = p->sz;
-
-  np->mmapsz = p->mmapsz;
-  for (int i = 0; i < 16; i++) if (p->vmas[i].valid) {
-      np->vmas[i] = p->vmas[i]; filedup(np->vmas[i].fd);
-  }
+  uvmflush(p);
+  np->mm->heapadv = p->mm->heapadv;
+  releasesleep(&p->mm->lock);
 
   // 拷贝保存到用户寄存器
   *(np->trapframe) = *(p->trapframe);
@@ -359,6 +458,108 @@ fork(void)
   return pid;
 }
 
+// 直接从path的程序创建子进程，不复制父进程的地址空间（spawn()）。
+// fds为0时子进程像fork()一样继承所有打开的文件；否则子进程只有
+// 文件描述符0..NSPAWNFD-1，i是父进程的fds[i]，-1表示不打开。
+// 返回子进程的pid，失败时返回-1。
+int
+spawn(char *path, char **argv, int *fds)
+{
+  int i, argc, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if(fds){
+    for(i = 0; i < NSPAWNFD; i++)
+      if(fds[i] != -1 && (fds[i] < 0 || fds[i] >= NOFILE || p->ofile[fds[i]] == 0))
+        return -1;
+  }
+
+  // 分配进程
+  if((np = allocproc(0)) == 0){
+    return -1;
+  }
+  // 新进程还不能运行，装入程序要用文件系统，不能持有np->lock
+  release(&np->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = execproc(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+
+  if(fds){
+    for(i = 0; i < NSPAWNFD; i++)
+      if(fds[i] != -1)
+        np->ofile[i] = filedup(p->ofile[fds[i]]);
+  } else {
+    for(i = 0; i < NOFILE; i++)
+      if(p->ofile[i])
+        np->ofile[i] = filedup(p->ofile[i]);
+  }
+  np->cwd = idup(p->cwd);
+
+  pid = np->pid;
+  np->tracemask = p->tracemask;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
+// 创建一个和当前进程共享地址空间的线程（clone()），从fn(arg)开始在用户栈stack上运行，
+// fn不能返回，要调用exit()。打开的文件和当前目录跟fork()一样复制引用。
+// 线程是当前进程的子进程，像子进程一样exit()和被wait()，
+// 地址空间在最后一个用它的进程exit()时才解除映射。返回线程的pid，失败时返回-1。
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc(p)) == 0){
+    return -1;
+  }
+
+  // gp、tp这些和父进程一样
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
+  np->trapframe->ra = 0;
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(np->name));
+  pid = np->pid;
+  np->tracemask = p->tracemask;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
 // 把p的孩子交给init进程
 // 调用者必须持有wait_lock
 void
@@ -385,6 +586,11 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // 解除所有mmap映射（包括exec的段），写回脏页。
+  // 别的线程还在用这个地址空间的话留给它们
+  if(mmleave(p->mm))
+    vmaunmap(p, 0, MMAPTOP);
+
   // 关闭所有打开的文件
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -487,28 +693,29 @@ scheduler(void)
     int found = 0;
     for(p = proc; p < &proc[NPROC]; p++) {
       acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // 切换到选择到进程。
-        // 释放进程锁，在跳回到这里之前还要重新获取锁，这是进程的工作
-        p->state = RUNNING;
-        c->proc = p;
-
-        // 切换到用户内核页表
-        w_satp(MAKE_SATP(p->kpagetable));
-        sfence_vma();
+      if(p->state != RUNNABLE) {
+        release(&p->lock);
+        continue;
+      }
+      // 切换到选择到进程。
+      // 释放进程锁，在跳回到这里之前还要重新获取锁，这是进程的工作
+      p->state = RUNNING;
+      c->proc = p;
 
-        swtch(&c->context, &p->context);
+      // 切换到进程的页表，内核映射是共享的
+      uvmswitch(p);
 
-        // 进程目前已完成运行。
-        // 它应该在回来之前改变它的p->state。
-        c->proc = 0;
+      swtch(&c->context, &p->context);
 
-        // 回到调度器就要切换回内核页表
-        kvminithart();
+      // 进程目前已完成运行，它在回来之前改变了自己的state。
+      // 中间可能直接切换过别的进程（见sched()），回来的是c->proc，
+      // 它的锁还被持有着。
+      // 回到调度器就要切换回内核页表，进程退出后它的页表会被释放
+      kvmswitch();
+      release(&c->proc->lock);
+      c->proc = 0;
 
-        found = 1;
-      }
-      release(&p->lock);
+      found = 1;
     }
     if(found == 0){
       intr_on();
@@ -517,7 +724,43 @@ scheduler(void)
   }
 }
 
-// 切换到调度器。 必须持有 p->lock 和 已经修改了proc->state
+// 找p之后的下一个可以运行的进程，找到的话持有它的锁返回。
+// 调用者持有p->lock，别的进程可能正持有自己的锁来找下一个进程，
+// 所以不能等锁，锁被持有的进程就跳过。
+static struct proc*
+pickproc(struct proc *p)
+{
+  struct proc *np = p;
+
+  for(int i = 1; i < NPROC; i++){
+    if(++np == &proc[NPROC])
+      np = proc;
+    if(np->state != RUNNABLE || !tryacquire(&np->lock))
+      continue;
+    if(np->state == RUNNABLE)
+      return np;
+    release(&np->lock);
+  }
+  return 0;
+}
+
+// 切换回来以后调用：如果是被直接切换过来的，释放切换走的进程的锁。
+// 那个进程的上下文保存完之前它的锁不能释放，所以留给切换到的这一边。
+static void
+switchdone(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *prev = c->prev;
+
+  if(prev){
+    c->prev = 0;
+    release(&prev->lock);
+  }
+}
+
+// 切换到别的进程。 必须持有 p->lock 和 已经修改了proc->state
+// 有可以运行的进程的话直接切换过去，不经过调度器；否则切换到调度器，
+// CPU空闲时由它等待。p仍然可以运行（yield）又没有别的进程的话继续运行p。
 // 保存和恢复intena， 因为intena是一个内核线程的属性，不是CPU的
 // 这应该是进程的属性的，例如proc->intena 和 proc->noff
 // 但这样做会在一些地方有问题，例如一个锁被持有了，但是没有进程
@@ -526,6 +769,8 @@ sched(void)
 {
   int intena;
   struct proc *p = myproc();
+  struct proc *np;
+  struct cpu *c;
 
   if(!holding(&p->lock))
     panic("sched p->lock");
@@ -536,8 +781,21 @@ sched(void)
   if(intr_get())
     panic("sched interruptible");
 
-  intena = mycpu()->intena;
-  swtch(&p->context, &mycpu()->context);
+  c = mycpu();
+  intena = c->intena;
+  if((np = pickproc(p)) != 0){
+    np->state = RUNNING;
+    c->proc = np;
+    c->prev = p;
+    uvmswitch(np);
+    swtch(&p->context, &np->context);
+    switchdone();
+  } else if(p->state == RUNNABLE){
+    p->state = RUNNING;
+  } else {
+    swtch(&p->context, &c->context);
+    switchdone();
+  }
   mycpu()->intena = intena;
 }
 
@@ -552,6 +810,17 @@ yield(void)
   release(&p->lock);
 }
 
+// 内核进程第一次被调度的时候到这里，见kproc()
+static void
+kprocret(void)
+{
+  // p->lock仍然被调度器（或者直接切换过来的那个进程）持有，所以这里要释放
+  switchdone();
+  release(&myproc()->lock);
+  myproc()->kfn();
+  panic("kproc returned");
+}
+
 // fork的子进程的第一次调度到这里，由调度器scheduler()调度
 // 将切换到forkret
 void
@@ -559,7 +828,8 @@ forkret(void)
 {
   static int first = 1;
 
-  // p->lock仍然被调度器持有，所以这里要释放
+  // p->lock仍然被调度器（或者直接切换过来的那个进程）持有，所以这里要释放
+  switchdone();
   release(&myproc()->lock);
 
   if (first) {
@@ -719,58 +989,182 @@ uint64 nproc()
   return cnt;
 }
 
-// 处理mmap
-int handle_mmap(uint64 va,struct proc *p){
-    for (int i = 0; i < 16; i++)
-        if (p->vmas[i].valid && va >= p->vmas[i].addr && va < p->vmas[i].addr + p->vmas[i].length) {
-            int perm = PTE_U;
-            if (p->vmas[i].prot & PROT_READ) perm |= PTE_R;
-            if (p->vmas[i].prot & PROT_WRITE) perm |= PTE_W;
-            uint64 base = PGROUNDDOWN(va);
-            char *pa = kalloc(); if (pa == 0) return -1; memset(pa, 0, PGSIZE);
-            mappages(p->pagetable, base, PGSIZE, (uint64)pa, perm);
-            begin_op(); ilock(p->vmas[i].fd->ip);
-            readi(p->vmas[i].fd->ip, 1, base, base - p->vmas[i].oaddr, PGSIZE);
-            iunlock(p->vmas[i].fd->ip); end_op();
-            return 0;
+// 按madvise()的建议决定一次缺页最多映射几页
+static int
+faultaround(int advice)
+{
+    if (advice == MADV_RANDOM) return 1;
+    if (advice == MADV_SEQUENTIAL) return 2 * FAULTAROUND;
+    return FAULTAROUND;
+}
+
+// 取ip从偏移off开始的一页（页缓存），调用者用完kfree()。
+// 缺页可能发生在readi()/writei()和同一个文件的映射之间拷贝的时候，
+// 这时已经持有ip->lock了，所以先不加锁查缓存，没有的话再看是不是自己持有锁。
+// 持有自旋锁的内核缺页（比如pipewrite()里的copyin()）不能读盘，缓存里没有就返回0。
+static uint64
+mmapgetpage(struct inode *ip, uint off)
+{
+    uint64 pa;
+    int locked;
+
+    if ((pa = pcacheget(ip->dev, ip->inum, off)) != 0) return pa;
+    if (holdingspin()) return 0;
+    if (!(locked = holdingsleep(&ip->lock))) ilock(ip);
+    pa = igetpage(ip, off);
+    if (!locked) iunlock(ip);
+    return pa;
+}
+
+// base这一页后面一部分是零（exec的段里数据和bss之间的那一页），
+// 不能共享缓存页，复制到一个私有的页里
+static int
+mmapfill(struct proc *p, struct vma *v, uint64 base, int perm)
+{
+    char *mem;
+    uint64 pa;
+
+    if ((mem = kalloc()) == 0) return -1;
+    if ((pa = mmapgetpage(v->ip, base - v->start + v->off)) == 0) {
+        kfree(mem); return -1;
+    }
+    memmove(mem, (char*)pa, v->fend - base);
+    memset(mem + (v->fend - base), 0, PGSIZE - (v->fend - base));
+    kfree((void*)pa);
+    if (mappages(p->pagetable, base, PGSIZE, (uint64)mem, perm) != 0) {
+        kfree(mem); return -1;
+    }
+    return 0;
+}
+
+// 处理mmap和exec的段，write表示是不是写缺页
+// 文件内容从页缓存取，直接映射缓存页；MAP_PRIVATE的可写映射带PTE_C，
+// 第一次写的时候再复制（写时拷贝），所以执行同一个程序的进程共享代码页。
+// 匿名映射和exec的bss读的时候映射全局零页，写的时候才分配。
+int handle_mmap(uint64 va, struct proc *p, int write){
+    struct vma *v = vmalookup(p->mm->vmas, va);
+    if (v == 0) return -1;
+    struct inode *ip = v->ip;
+    uint64 base = PGROUNDDOWN(va);
+    pte_t *pte = walk(p->pagetable, base, 0);
+    if (pte && (*pte & PTE_V)) {
+        if ((*pte & PTE_C) && (v->prot & PROT_WRITE)) return cowpage(pte) < 0 ? -1 : 1;
+        return -1;  // 已经映射了，权限不对
+    }
+    int perm = PTE_U;
+    if (v->prot & PROT_READ) perm |= PTE_R;
+    if (v->prot & PROT_WRITE) perm |= PTE_W;
+    if (v->prot & PROT_EXEC) perm |= PTE_X;
+    int anon = ip == 0 || base >= v->fend;
+    if (anon && (write || (v->flags & MAP_SHARED))) {
+        char *mem = kalloc();
+        if (mem == 0) return -1;
+        memset(mem, 0, PGSIZE);
+        if (mappages(p->pagetable, base, PGSIZE, (uint64)mem, perm) != 0) {
+            kfree(mem); return -1;
         }
-    return -1;
+        return 0;
+    }
+    if (!anon && base + PGSIZE > v->fend)
+        return mmapfill(p, v, base, perm);
+    if ((v->flags & MAP_PRIVATE) && (perm & PTE_W))
+        perm = (perm & ~PTE_W) | PTE_C;
+    if (anon) {
+        if (mappages(p->pagetable, base, PGSIZE, (uint64)zeropage, perm) != 0) return -1;
+        kref((uint64)zeropage);
+        return 0;
+    }
+    uint64 pa = mmapgetpage(ip, base - v->start + v->off);
+    if (pa == 0) return -1;
+    if (mappages(p->pagetable, base, PGSIZE, pa, perm) != 0) {
+        kfree((void*)pa); return -1;
+    }
+    // 别的线程可能已经通过刚映射的缓存页读过了，换掉的话要清所有hart
+    int r = 0;
+    if (write && (perm & PTE_C) && (r = cowpage(walk(p->pagetable, base, 0))) < 0)
+        return -1;
+    // fault-around：后面几页已经在页缓存里的话一起映射，
+    // MADV_SEQUENTIAL的话不在缓存里的也读进来
+    for (uint64 a = base + PGSIZE; a < base + faultaround(v->advice)*PGSIZE && a + PGSIZE <= v->fend; a += PGSIZE) {
+        pte = walk(p->pagetable, a, 0);
+        if (pte && *pte) continue;
+        uint off = a - v->start + v->off;
+        if (v->advice == MADV_SEQUENTIAL)
+            pa = mmapgetpage(ip, off);
+        else
+            pa = pcacheget(ip->dev, ip->inum, off);
+        if (pa == 0) continue;
+        if (mappages(p->pagetable, a, PGSIZE, pa, perm) != 0) {
+            kfree((void*)pa); break;
+        }
+    }
+    return r;
 }
 
-// 处理用户缺页
-int handle_pagefault(uint64 va, struct proc *p) {
-    if (va >= (1L << 37) && va <= (1L << 57)){
-      return handle_mmap(va,p);
+// 给懒分配的堆页base分配一个清零的物理页。
+// 读缺页的话映射全局零页（只读，写时拷贝），第一次写的时候才分配。
+static int
+lazyalloc(struct proc *p, uint64 base, int write)
+{
+    char *mem;
+    if (!write) {
+        if (mappages(p->pagetable, base, PGSIZE, (uint64)zeropage, PTE_X|PTE_R|PTE_U|PTE_C) != 0)
+            return -1;
+        kref((uint64)zeropage);
+        return 0;
+    }
+    if ((mem = kalloc()) == 0) return -1;
+    memset(mem, 0, PGSIZE);
+    if (mappages(p->pagetable, base, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0) {
+        kfree(mem);
+        return -1;
+    }
+    return 0;
+}
+
+// 处理用户缺页，write表示是不是写缺页。调用者持有p->mm->lock。
+// 返回-1表示失败，1表示换掉了一个有效的映射（写时拷贝复制了页），
+// 别的hart上的TLB项要清掉，0表示只加了映射。
+static int pagefault(uint64 va, struct proc *p, int write) {
+    pte_t *pte;
+    int r;
+
+    if (va >= MAXVA)
+      return -1;
+    // fork以后和别的进程共享的页表页：分开以后页已经可以这样访问的话就好了。
+    // 有别的线程的话，也可能是这个hart缓存了映射之前的无效项，或者别的线程已经处理过了
+    if ((r = uvmunshare(p->pagetable, va)) < 0)
+      return -1;
+    if ((r || p->mm->ref > 1) && (pte = walk(p->pagetable, va, 0)) && (*pte & PTE_V) && (*pte & PTE_U) &&
+        (*pte & (write ? PTE_W : PTE_R)))
+      return 0;
+
+    if (va >= MMAPBASE && va < MMAPTOP){
+      return handle_mmap(va, p, write);
     }
 
     uint64 base =  PGROUNDDOWN(va);
-    if (va >= p->sz) {
+    if (va >= p->mm->sz) {
       return -1;
     }
 
-    pte_t *pte; char *mem; uint flags;
+    // exec的段
+    if (vmalookup(p->mm->vmas, va))
+      return handle_mmap(va, p, write);
+
     if ((pte = walk(p->pagetable, va, 0)) && *pte & PTE_C) {
-      if ((mem = kalloc()) == 0) return -1;
-      flags = PTE_FLAGS((*pte & (~PTE_C)) | PTE_W);
-      uint64 pa = PTE2PA(*pte);
-      memmove(mem, (char*)pa, PGSIZE);
-      *pte = PA2PTE((uint64)mem) | flags;
-      kfree((void *)pa);
-      pte = walk(p->kpagetable, va, 1);
-      flags = flags & (~PTE_U);
-      *pte = PA2PTE((uint64)mem) | flags; 
+      return cowpage(pte);
     }
     else{
       if(!pte || !*pte){
-        if ((mem = kalloc()) == 0) return -1;
-        memset(mem, 0, PGSIZE);
-        if(mappages(p->pagetable, base, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0) {
-            kfree(mem); 
-        kfree(mem); 
-            kfree(mem); 
-        kfree(mem); 
-            kfree(mem); 
-            return -1;
+        if (lazyalloc(p, base, write) != 0) return -1;
+        // fault-around：顺序访问（前一页已经映射了，或者MADV_SEQUENTIAL）时
+        // 顺便分配后面几页，没有内存了就算了，缺页的这一页已经好了
+        if (p->mm->heapadv == MADV_SEQUENTIAL || (base >= PGSIZE && walkaddr(p->pagetable, base - PGSIZE))) {
+          for (uint64 a = base + PGSIZE; a < base + faultaround(p->mm->heapadv)*PGSIZE && a < p->mm->sz; a += PGSIZE) {
+            if ((pte = walk(p->pagetable, a, 0)) && *pte) break;
+            if (lazyalloc(p, a, write) != 0) break;
+          }
         }
       } else{
         return -1;
@@ -779,24 +1173,98 @@ int handle_pagefault(uint64 va, struct proc *p) {
     return 0;
 }
 
-// 处理内核缺页
-int handle_kpagefault(uint64 va, struct proc *p) {
-    uint64 base =  PGROUNDDOWN(va);
-    if (va >= p->sz) {
-      return -1;
-    }
-    uint64 pa = walkaddr(p->pagetable, base);
-    if(pa == 0){
-        char *mem = kalloc();
-        if (mem == 0) return -1;
-        memset(mem, 0, PGSIZE);
-        if(mappages(p->pagetable, base, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0) {
-            kfree(mem); 
-            return -1;
-        }
+// 拿地址空间的锁。内核缺页时可能持有自旋锁（比如pipewrite()里的copyin()），
+// 这时不能睡眠，只能转着等。持有锁的线程可能在uvmflush()里等这个hart清TLB，
+// 所以一边等一边回应；uvmflush()也不等记在mmwait里的hart，它们拿到锁以后再清
+void
+mmlock(struct mm *mm)
+{
+    struct cpu *c;
+
+    push_off();
+    c = mycpu();
+    if (c->noff == 1) {
+      pop_off();
+      acquiresleep(&mm->lock);
+      return;
     }
-    if (kvmcopy(p->pagetable, p->kpagetable, base, base + PGSIZE) != 0) {
-        return -1;
+    c->mmwait = mm;
+    while (!tryacquiresleep(&mm->lock))
+      tlbpoll();
+    c->mmwait = 0;
+    tlbpoll();
+    pop_off();
+}
+
+// 处理用户缺页，然后清TLB：写时拷贝换掉了页的话清所有hart上的，
+// 新映射的页只清这个hart上缓存的无效项。调用者持有p->mm->lock。
+int
+uvmfault(struct proc *p, uint64 va, int write)
+{
+    int r;
+
+    if ((r = pagefault(va, p, write)) > 0)
+      uvmflush(p);
+    else if (r == 0)
+      uvmflushhart();
+    return r < 0 ? -1 : 0;
+}
+
+static int nfault;      // handle_pagefault()处理过的缺页数，给stats设备
+
+int handle_pagefault(uint64 va, struct proc *p, int write) {
+    int r;
+
+    __atomic_add_fetch(&nfault, 1, __ATOMIC_RELAXED);
+    mmlock(p->mm);
+    r = uvmfault(p, va, write);
+    releasesleep(&p->mm->lock);
+    return r;
+}
+
+int
+statsfault(char *buf, int sz)
+{
+    return snprintf(buf, sz, "--- vm: faults %d\n", nfault);
+}
+
+// 预先处理[start, end)里还没有映射的页（MAP_POPULATE、MADV_WILLNEED），
+// write表示当成写缺页处理。没有内存时停下返回-1，剩下的页还是按需分配。
+// 调用者持有p->mm->lock。
+int
+populate(struct proc *p, uint64 start, uint64 end, int write)
+{
+    int r = 0, flush = 0;
+
+    for (uint64 a = PGROUNDDOWN(start); a < end && r >= 0; a += PGSIZE)
+        if (walkaddr(p->pagetable, a) == 0 && (r = pagefault(a, p, write)) > 0)
+            flush = 1;
+    if (flush)
+      uvmflush(p);
+    else
+      uvmflushhart();
+    return r < 0 ? -1 : 0;
+}
+
+// 内核持有自旋锁的时候要直接访问用户内存[va, va+len)（比如pipewrite()里的copyin()）。
+// 这时缺页不能睡眠，也没法失败返回，所以先拿着mm->lock（转着等）把还没有映射的页映射好，
+// 访问完以后调用者releasesleep(&p->mm->lock)；这期间别的线程改不了映射，不会再缺页。
+// 要读盘才能映射的页现在映射不了，返回-1，不持有锁。
+int
+uvmprefault(struct proc *p, uint64 va, uint64 len)
+{
+    mmlock(p->mm);
+    if (populate(p, va, va + len, 0) < 0) {
+      releasesleep(&p->mm->lock);
+      return -1;
     }
     return 0;
+}
+
+// 处理内核缺页：内核用SUM直接访问用户内存时碰到了还没有映射的页。
+// 持有自旋锁时只处理不会睡眠的（页缓存里有的页、匿名页和零页、写时拷贝）
+int handle_kpagefault(uint64 va, struct proc *p, int write) {
+    if (va >= MAXVA)
+      return -1;
+    return handle_pagefault(va, p, write);
 }
\ No newline at end of file
@@ -24,6 +24,10 @@ struct cpu {
   struct context context;     // swtch() 这里再进入 scheduler().
   int noff;                   // push_off() 嵌套的深度.
   int intena;                 // 在push_off()之前是否启用了中断？
+  uint64 asidgen;             // 这个hart的TLB是在哪一代ASID开始时清过的
+  struct proc *prev;          // 直接切换过来的进程，它的锁还没有释放
+  int tlbreq;                 // 别的hart改了这里正在运行的地址空间，要清TLB，见uvmflush()
+  struct mm *mmwait;          // 持有自旋锁、转着等这个地址空间的锁，见mmlock()
 };
 
 extern struct cpu cpus[NCPU];
@@ -75,9 +79,29 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// mmap映射的一段虚拟地址，见vma.c
 struct vma {
-    uint64 addr, oaddr; int valid, length, prot, flags;
-    struct file *fd;
+  uint64 start, end;        // [start, end)，页对齐
+  uint64 off;               // start对应的文件偏移
+  uint64 fend;              // 文件内容只映射到fend，后面是零（exec的bss）
+  int prot, flags;
+  int advice;               // madvise()，MADV_NORMAL等
+  struct inode *ip;
+  struct vma *left, *right; // AVL树
+  int height;
+};
+
+// 地址空间。clone()出来的线程和创建它的进程共享同一个，见proc.c。
+// 页表指针每个进程都存了一份（p->pagetable），只有exec()会换。
+struct mm {
+  struct sleeplock lock;       // 缺页和改地址空间的系统调用持有
+  int ref;                     // 用它的进程数，包括还没有被wait()的僵尸
+  int live;                    // 还没有exit()的进程数
+  uint64 sz;                   // 进程内存大小（字节）
+  struct vma *vmas;            // mmap区域，按地址排序的AVL树
+  int heapadv;                 // 对[0, sz)的madvise()
+  uint64 asid;                 // 地址空间的ASID，高位是代数，见vm.c
+  uint64 stale;                // 这些hart上可能有过时的TLB项（按hart的位图）
 };
 
 // 每个进程状态
@@ -96,20 +120,19 @@ struct proc {
 
   // 这些是进程私有的，因此不需要持有p->lock。
   uint64 kstack;               // 内核栈的虚拟地址
-  char *kstackpa;              // 内核栈的物理地址
-  uint64 sz;                   // 进程内存大小（字节）
-  pagetable_t pagetable;       // 用户页表
-  pagetable_t kpagetable;      // 用户内核页表
+  struct mm *mm;               // 地址空间，线程之间共享
+  pagetable_t pagetable;       // 用户页表，就是mm的页表
   struct trapframe *trapframe; // trampoline.S的数据页
+  uint64 trapframeva;          // trapframe在用户页表里的地址
   struct context context;      // swtch() 到这里然后运行进程
   struct file *ofile[NOFILE];  // 打开的文件
   struct inode *cwd;           // 当前目录
   char name[16];               // 进程名字(调试用)
+  void (*kfn)(void);           // 内核进程的入口，见kproc()
+  int nlogged;                 // 当前FS操作新加到日志里的块数，见log_room()
   int tracemask;               // 实验（syscall）加的，用来跟踪系统调用
   int ticks;
   int duration;
   uint64 handler;
-  struct trapframe state_time;
-  struct vma vmas[16];  // lab mmap
-  uint64 mmapsz;
+  uint64 sigframe;              // 闹钟处理函数的寄存器帧在用户栈上的地址
 };
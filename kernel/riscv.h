@@ -71,6 +71,7 @@ wfi()
 
 // 管理员状态寄存器（Supervisor Status Register），sstatus
 
+#define SSTATUS_SUM (1L << 18) // 内核可以读写用户页（Supervisor User Memory access）
 #define SSTATUS_SPP (1L << 8)  // 之前的模式, 1=内核, 0=用户
 #define SSTATUS_SPIE (1L << 5) // 管理员之前的中断启用（Supervisor Previous Interrupt Enable）
 #define SSTATUS_UPIE (1L << 4) // 用户之前的中断启用（User Previous Interrupt Enable）
@@ -218,6 +219,11 @@ w_mtvec(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// satp的44..59位是ASID，TLB项用它区分地址空间，切换页表时就不用清TLB了。
+#define SATP_ASIDSHIFT 44
+#define SATP_ASIDMASK 0xFFFFL
+#define MAKE_SATP_ASID(pagetable, asid) (MAKE_SATP(pagetable) | (((uint64)(asid) & SATP_ASIDMASK) << SATP_ASIDSHIFT))
+
 // 管理员地址翻译和保护；（supervisor address translation and protection）
 // 保存页表的地址。
 static inline void 
@@ -353,6 +359,13 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// 只刷新地址空间asid的TLB条目，全局映射（PTE_G）不受影响。
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
 // 读取栈地址
 static inline uint64
 r_fp()
@@ -374,7 +387,12 @@ r_fp()
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> 用户可以访问
+#define PTE_G (1L << 5) // 全局映射，所有地址空间都一样，不属于某个ASID
+#define PTE_A (1L << 6) // 访问过
+#define PTE_D (1L << 7) // 写过（脏页）
 #define PTE_C (1L << 8) // 写时拷贝（lab cow）
+#define PTE_K (1L << 9) // 用户页表里共享的内核映射，释放页表时跳过
+#define PTE_S (1L << 8) // 非叶子项：和别的进程共享的写时拷贝页表页（fork）
 
 // 移动物理地址到一个正确地方就能转化为PTE
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -0,0 +1,268 @@
+// 小对象分配器。
+//
+// 每种对象一个kcache，从kalloc()拿页做slab：页头是struct slab，后面是同样大小的对象。
+// 空闲对象的下标放在页头的栈里，不写对象本身，所以构造函数（ctor）只在slab新建时
+// 对每个对象调用一次，对象释放的时候要恢复成构造好的样子（比如锁是放开的）。
+// 释放的时候PGROUNDDOWN就找到slab和kcache。
+//
+// 每个CPU在每个kcache上缓存最多NCPUCACHE个对象，分配和释放一般只关中断，不拿锁；
+// 缓存空了或者满了才拿kcache的锁，成批地从slab取或者还回slab。
+// 中断处理函数里也可以分配和释放。全空的slab每个kcache留一个，多的还给kalloc()。
+//
+// kmalloc()按2的幂的大小类从kmcache[]里分，最大KMAXSIZE；更大的用kalloc()。
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "defs.h"
+
+#define SLABMAGIC 0x51ab
+#define KMINSHIFT 5             // kmalloc()最小32字节
+#define NKMCLASS 7              // 32, 64, ..., 2048
+#define KMAXSIZE (1 << (KMINSHIFT + NKMCLASS - 1))
+
+struct slab {
+  struct kcache *cache;
+  struct slab *next, *prev;     // kcache的partial链表
+  ushort magic;
+  ushort nfree;                 // 空闲对象数，freeidx[0..nfree)是它们的下标
+  uchar freeidx[];
+};
+
+static struct {
+  struct spinlock lock;
+  struct kcache *list;          // 所有kcache，统计用
+} kcaches;
+
+static struct kcache kmcache[NKMCLASS];
+static char *kmnames[NKMCLASS] = {
+  "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256",
+  "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+// 初始化对象大小为size的kcache，ctor可以是0
+void
+kcacheinit(struct kcache *c, char *name, uint size, void (*ctor)(void*))
+{
+  uint n;
+
+  size = (size + 7) & ~7;
+  // 页头加上每个对象一个字节的下标
+  n = (PGSIZE - sizeof(struct slab)) / (size + 1);
+  while(n > 0 && ((sizeof(struct slab) + n + 7) & ~7) + n * size > PGSIZE)
+    n--;
+  if(n == 0 || n > 255)
+    panic("kcacheinit");
+  c->name = name;
+  c->size = size;
+  c->nobj = n;
+  c->off = (sizeof(struct slab) + n + 7) & ~7;
+  c->ctor = ctor;
+  initlock(&c->lock, "kcache");
+  c->partial = 0;
+  c->nslab = c->nempty = c->nfree = 0;
+  memset(c->cpu, 0, sizeof(c->cpu));
+
+  acquire(&kcaches.lock);
+  c->next = kcaches.list;
+  kcaches.list = c;
+  release(&kcaches.lock);
+}
+
+void
+kmallocinit(void)
+{
+  initlock(&kcaches.lock, "kcaches");
+  for(int i = 0; i < NKMCLASS; i++)
+    kcacheinit(&kmcache[i], kmnames[i], 1 << (KMINSHIFT + i), 0);
+}
+
+static void
+slabpush(struct kcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+static void
+slabunlink(struct kcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// 新建一个slab，对象都构造好。不拿锁
+static struct slab*
+slabnew(struct kcache *c)
+{
+  struct slab *s;
+
+  if((s = kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->magic = SLABMAGIC;
+  s->nfree = c->nobj;
+  for(int i = 0; i < c->nobj; i++){
+    s->freeidx[i] = c->nobj - 1 - i;
+    if(c->ctor)
+      c->ctor((char*)s + c->off + i * c->size);
+  }
+  return s;
+}
+
+// 给本CPU的缓存补充最多NCPUCACHE/2个对象，调用时关着中断
+static void
+refill(struct kcache *c, struct kcachecpu *cc)
+{
+  struct slab *s;
+
+  acquire(&c->lock);
+  while(cc->n < NCPUCACHE/2){
+    if((s = c->partial) == 0){
+      release(&c->lock);
+      if((s = slabnew(c)) == 0)
+        return;
+      acquire(&c->lock);
+      slabpush(c, s);
+      c->nslab++;
+      c->nempty++;
+      c->nfree += c->nobj;
+    }
+    if(s->nfree == c->nobj)
+      c->nempty--;
+    while(s->nfree > 0 && cc->n < NCPUCACHE/2){
+      cc->obj[cc->n++] = (char*)s + c->off + s->freeidx[--s->nfree] * c->size;
+      c->nfree--;
+    }
+    if(s->nfree == 0)
+      slabunlink(c, s);
+  }
+  release(&c->lock);
+}
+
+// 把本CPU缓存里的n个对象还回slab，调用时关着中断
+static void
+drain(struct kcache *c, struct kcachecpu *cc, int n)
+{
+  struct slab *s, *empty = 0;
+  char *o;
+
+  acquire(&c->lock);
+  while(n-- > 0 && cc->n > 0){
+    o = cc->obj[--cc->n];
+    s = (struct slab*)PGROUNDDOWN((uint64)o);
+    if(s->nfree == 0)
+      slabpush(c, s);
+    s->freeidx[s->nfree++] = (o - (char*)s - c->off) / c->size;
+    c->nfree++;
+    if(s->nfree == c->nobj){
+      if(c->nempty > 0){
+        // 已经有一个全空的了，这一页还回去
+        slabunlink(c, s);
+        c->nslab--;
+        c->nfree -= c->nobj;
+        s->next = empty;
+        empty = s;
+      } else
+        c->nempty++;
+    }
+  }
+  release(&c->lock);
+  for(; empty; empty = s){
+    s = empty->next;
+    kfree(empty);
+  }
+}
+
+// 分配一个构造好的对象，没有内存时返回0
+void*
+kcachealloc(struct kcache *c)
+{
+  struct kcachecpu *cc;
+  void *o = 0;
+
+  push_off();
+  cc = &c->cpu[cpuid()];
+  if(cc->n == 0)
+    refill(c, cc);
+  if(cc->n > 0){
+    o = cc->obj[--cc->n];
+    cc->nalloc++;
+  }
+  pop_off();
+  return o;
+}
+
+void
+kcachefree(struct kcache *c, void *o)
+{
+  struct kcachecpu *cc;
+
+  if(((struct slab*)PGROUNDDOWN((uint64)o))->cache != c)
+    panic("kcachefree");
+  push_off();
+  cc = &c->cpu[cpuid()];
+  if(cc->n == NCPUCACHE)
+    drain(c, cc, NCPUCACHE/2);
+  cc->obj[cc->n++] = o;
+  pop_off();
+}
+
+// 分配n字节（n <= KMAXSIZE），内容不确定
+void*
+kmalloc(uint n)
+{
+  int i = 0;
+
+  if(n > KMAXSIZE)
+    return 0;
+  while((1 << (KMINSHIFT + i)) < n)
+    i++;
+  return kcachealloc(&kmcache[i]);
+}
+
+void
+kmfree(void *p)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)p);
+
+  if(s->magic != SLABMAGIC)
+    panic("kmfree");
+  kcachefree(s->cache, p);
+}
+
+// 给stats设备：每个kcache的对象大小、在用的对象数、slab页数和分配次数
+int
+statsslab(char *buf, int sz)
+{
+  struct kcache *c;
+  int n, used;
+  uint64 nalloc;
+
+  n = snprintf(buf, sz, "--- slab: name size inuse slabs allocs\n");
+  acquire(&kcaches.lock);
+  for(c = kcaches.list; c; c = c->next){
+    acquire(&c->lock);
+    used = c->nslab * c->nobj - c->nfree;
+    nalloc = 0;
+    for(int i = 0; i < NCPU; i++){
+      used -= c->cpu[i].n;
+      nalloc += c->cpu[i].nalloc;
+    }
+    n += snprintf(buf+n, sz-n, "%s %d %d %d %d\n",
+                  c->name, c->size, used, c->nslab, (int)nalloc);
+    release(&c->lock);
+  }
+  release(&kcaches.lock);
+  return n;
+}
@@ -0,0 +1,25 @@
+// 小对象分配器，见slab.c
+#define NCPUCACHE 16    // 每个CPU缓存的对象数
+
+struct kcachecpu {
+  int n;
+  void *obj[NCPUCACHE];
+  uint64 nalloc;        // 分配次数
+} __attribute__((aligned(64)));
+
+struct kcache {
+  char *name;
+  uint size;            // 对象大小，8字节对齐
+  int nobj;             // 每个slab的对象数
+  uint off;             // 第一个对象在页里的偏移
+  void (*ctor)(void*);  // 新建slab时构造每个对象
+
+  struct spinlock lock; // 保护下面的slab链表和计数
+  struct slab *partial; // 有空闲对象的slab
+  int nslab;            // slab页数
+  int nempty;           // 全空的slab数
+  int nfree;            // slab里空闲的对象数（不算CPU缓存里的）
+
+  struct kcachecpu cpu[NCPU];
+  struct kcache *next;  // 所有kcache的链表
+};
@@ -4,6 +4,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
@@ -74,12 +75,13 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
+  // 转着等的时候也响应别的hart清TLB的请求（见uvmflush()），
+  // 它可能正持有这个锁等着我们
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0) {
   #ifdef LAB_LOCK
       __sync_fetch_and_add(&(lk->nts), 1);
-  #else
-    ;
   #endif
+    tlbpoll();
   }
   // 告诉C编译器和处理器不要移动加载或存储
   // 过了这一点，要保证关键段的内存
@@ -91,6 +93,26 @@ acquire(struct spinlock *lk)
   lk->cpu = mycpu();
 }
 
+// 不等待的acquire()：锁已经被持有的话马上返回0，获得了锁返回1。
+int
+tryacquire(struct spinlock *lk)
+{
+  push_off();
+  if(holding(lk))
+    panic("tryacquire");
+
+  if(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+    pop_off();
+    return 0;
+  }
+  #ifdef LAB_LOCK
+  __sync_fetch_and_add(&(lk->n), 1);
+  #endif
+  __sync_synchronize();
+  lk->cpu = mycpu();
+  return 1;
+}
+
 // 释放锁
 void
 release(struct spinlock *lk)
@@ -126,6 +148,18 @@ holding(struct spinlock *lk)
   return r;
 }
 
+// 这个hart持有自旋锁（或者关了中断）吗？这时不能睡眠
+int
+holdingspin(void)
+{
+  int r;
+
+  push_off();
+  r = mycpu()->noff > 1;
+  pop_off();
+  return r;
+}
+
 // push_off/pop_off 与 intr_off()/intr_on() 类似，只是它们是匹配的：
 // 需要两个ppop_off()才能撤消两个push_off()的操作。另外，如果中断
 // 一开始中断是关闭的，然后push_off, pop_off会继续让中断关闭
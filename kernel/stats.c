@@ -40,6 +40,10 @@ statsread(int user_dst, uint64 dst, int n)
 #ifdef LAB_LOCK
     stats.sz = statslock(stats.buf, BUFSZ);
 #endif
+    stats.sz += statsslab(stats.buf + stats.sz, BUFSZ - stats.sz);
+    stats.sz += statsmbuf(stats.buf + stats.sz, BUFSZ - stats.sz);
+    stats.sz += statsfault(stats.buf + stats.sz, BUFSZ - stats.sz);
+    stats.sz += statsvma(stats.buf + stats.sz, BUFSZ - stats.sz);
   }
   m = stats.sz - stats.off;
 
@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "syscall.h"
 #include "defs.h"
@@ -12,7 +13,7 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz)
+  if(addr >= p->mm->sz || addr+sizeof(uint64) > p->mm->sz)
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -111,6 +112,13 @@ extern uint64 sys_symlink(void);
 extern uint64 sys_mmap(void);
 extern uint64 sys_munmap(void);
 extern uint64 sys_connect(void);
+extern uint64 sys_msync(void);
+extern uint64 sys_sbrkf(void);
+extern uint64 sys_madvise(void);
+extern uint64 sys_fadvise(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_futex(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -142,6 +150,13 @@ static uint64 (*syscalls[])(void) = {
 [SYS_mmap]    sys_mmap,
 [SYS_munmap]  sys_munmap,
 [SYS_connect] sys_connect,
+[SYS_msync]   sys_msync,
+[SYS_sbrkf]   sys_sbrkf,
+[SYS_madvise] sys_madvise,
+[SYS_fadvise] sys_fadvise,
+[SYS_spawn]   sys_spawn,
+[SYS_clone]   sys_clone,
+[SYS_futex]   sys_futex,
 };
 
 char * syscall_name[NELEM(syscalls)] = {
@@ -150,7 +165,8 @@ char * syscall_name[NELEM(syscalls)] = {
   "dup", "getpid", "sbrk", "sleep", "uptime",
   "open", "write", "mknod", "unlink", "link",
   "mkdir", "close", "trace","sysinfo","sigalarm","sigreturn",
-  "symlink","mmap","munmap","connect"
+  "symlink","mmap","munmap","connect","msync","sbrkf",
+  "madvise","fadvise","spawn","clone","futex"
 };
 
 void
@@ -163,7 +179,7 @@ syscall(void)
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     p->trapframe->a0 = syscalls[num]();
     // 打印跟踪信息，实验（systemcall）
-    if((1 << num) & p->tracemask)
+    if(num < 32 && ((1 << num) & p->tracemask))
        printf("%d: syscall %s -> %d\n",p->pid,syscall_name[num],p->trapframe->a0);
   } else {
     printf("%d %s: unknown sys call %d\n",
@@ -28,3 +28,10 @@
 #define SYS_mmap   27
 #define SYS_munmap 28
 #define SYS_connect 29
+#define SYS_msync  30
+#define SYS_sbrkf  31
+#define SYS_madvise 32
+#define SYS_fadvise 33
+#define SYS_spawn  34
+#define SYS_clone  35
+#define SYS_futex  36
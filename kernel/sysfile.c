@@ -8,11 +8,12 @@
 #include "riscv.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "fs.h"
-#include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
 
@@ -422,23 +423,21 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// 把用户的参数数组uargv复制到argv[MAXARG]，每个字符串一页。
+// 失败时返回-1，不管成功失败调用者都要freeargv()。
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      goto bad;
+    if(i >= MAXARG){
+      return -1;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      goto bad;
+      return -1;
     }
     if(uarg == 0){
       argv[i] = 0;
@@ -446,22 +445,54 @@ sys_exec(void)
     }
     argv[i] = kalloc();
     if(argv[i] == 0)
-      goto bad;
+      return -1;
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
+      return -1;
   }
+  return 0;
+}
 
-  int ret = exec(path, argv);
-
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
     kfree(argv[i]);
+}
+
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret = -1;
 
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) == 0)
+    ret = exec(path, argv);
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// int spawn(char *path, char **argv, int *fds)
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv, ufds;
+  int fds[NSPAWNFD];
+  int ret = -1;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 || argaddr(2, &ufds) < 0){
+    return -1;
+  }
+  if(ufds && copyin(myproc()->pagetable, (char*)fds, ufds, sizeof(fds)) < 0)
+    return -1;
+  if(fetchargv(uargv, argv) == 0)
+    ret = spawn(path, argv, ufds ? fds : 0);
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -510,51 +541,74 @@ uint64 sys_symlink(void) {
     end_op(); return 0;
 }
 
+// MAP_ANONYMOUS不需要文件，fd被忽略。
+// MAP_SHARED的匿名映射马上分配好，这样fork以后父子才能共享。
 uint64 sys_mmap(void) {
-    int length, prot, flags; struct file *fd;
-    if (argint(1, &length) < 0 || argint(2, &prot) < 0 || argint(3, &flags) || argfd(4, 0, &fd)) return -1;
-    if (length % PGSIZE != 0 || (fd->writable == 0 && (prot & PROT_WRITE) && flags == MAP_SHARED)) return -1;
-    struct proc *p = myproc();
-    uint64 addr = (1L << 37) + p->mmapsz;
-    for (int i = 0; i < 16; i++) if (!p->vmas[i].valid) {
-        p->vmas[i].valid = 1; p->vmas[i].addr = p->vmas[i].oaddr = addr;
-        p->vmas[i].length = length; p->vmas[i].prot = prot;
-        p->vmas[i].flags = flags; p->vmas[i].fd = fd;
-        filedup(fd); p->mmapsz += length; return addr;
+    int length, prot, flags, offset; struct file *fd = 0;
+    if (argint(1, &length) < 0 || argint(2, &prot) < 0 || argint(3, &flags) < 0 || argint(5, &offset) < 0) return -1;
+    int anon = (flags & MAP_ANONYMOUS) != 0;
+    if (!anon && (argfd(4, 0, &fd) < 0 || fd->type != FD_INODE)) return -1;
+    if (length <= 0 || length % PGSIZE != 0 || offset < 0 || offset % PGSIZE != 0) return -1;
+    if (!anon && fd->writable == 0 && (prot & PROT_WRITE) && (flags & MAP_SHARED)) return -1;
+    struct proc *p = myproc(); struct vma *v;
+    acquiresleep(&p->mm->lock);
+    uint64 addr = vmagap(p->mm->vmas, length, MMAPBASE, MMAPTOP);
+    if (addr == 0 || (v = vmaalloc()) == 0) {
+        releasesleep(&p->mm->lock); return -1;
     }
-    return -1;
+    v->start = addr; v->end = v->fend = addr + length; v->off = anon ? 0 : offset;
+    v->prot = prot; v->flags = flags & ~MAP_POPULATE; v->ip = anon ? 0 : idup(fd->ip);
+    vmainsert(&p->mm->vmas, v);
+    if (anon && (flags & MAP_SHARED)) {
+        if (populate(p, addr, addr + length, 1) < 0) {
+            vmaunmap(p, addr, length);
+            addr = -1;
+        }
+    } else if (flags & MAP_POPULATE)
+        populate(p, addr, addr + length, 1);
+    releasesleep(&p->mm->lock);
+    return addr;
 }
 uint64 sys_munmap(void) {
-    uint64 addr; int length;
+    uint64 addr; int length, r;
     if (argaddr(0, &addr) < 0 || argint(1, &length) < 0) return -1;
-    if (addr % PGSIZE != 0 || length % PGSIZE != 0) return -1;
+    if (addr % PGSIZE != 0 || length % PGSIZE != 0 || length < 0) return -1;
     struct proc *p = myproc();
-    for (int i = 0; i < 16; i++) {
-        if (p->vmas[i].valid
-            && (addr + length == p->vmas[i].addr + p->vmas[i].length
-            || addr == p->vmas[i].addr)) {
-            for (int j = 0; j < length; j += PGSIZE) {
-                if (walkaddr(p->pagetable, addr + j) == 0) continue;
-                if (p->vmas[i].flags == MAP_SHARED) {
-                    begin_op(); ilock(p->vmas[i].fd->ip);
-                    writei(p->vmas[i].fd->ip, 1, addr + j, addr + j - p->vmas[i].oaddr, PGSIZE);
-                    iunlock(p->vmas[i].fd->ip); end_op();
-                }
-                uvmunmap(p->pagetable, j + addr, 1, 1);
-            }
-            if (addr + length == p->vmas[i].addr + p->vmas[i].length)
-                p->vmas[i].length = addr - p->vmas[i].addr;
-            else {
-                p->vmas[i].addr = addr + length;
-                p->vmas[i].length -= length;
-            }
-            if (p->vmas[i].length == 0) {
-                fileclose(p->vmas[i].fd); p->vmas[i].valid = 0;
-            }
-            return 0;
-        }
-    }
-    return 0;
+    acquiresleep(&p->mm->lock);
+    r = vmaunmap(p, addr, length);
+    releasesleep(&p->mm->lock);
+    return r;
+}
+// 把映射里改过的页写回文件，不解除映射。
+// xv6没有后台写回，MS_ASYNC也是同步写的。
+uint64 sys_msync(void) {
+    uint64 addr; int length, flags;
+    if (argaddr(0, &addr) < 0 || argint(1, &length) < 0 || argint(2, &flags) < 0) return -1;
+    if (addr % PGSIZE != 0 || length < 0) return -1;
+    struct proc *p = myproc(); int r;
+    acquiresleep(&p->mm->lock);
+    r = vmasync(p, addr, length);
+    releasesleep(&p->mm->lock);
+    return r;
+}
+// 告诉内核以后怎么访问[addr, addr+length)，堆和mmap区域都可以
+uint64 sys_madvise(void) {
+    uint64 addr; int length, advice;
+    if (argaddr(0, &addr) < 0 || argint(1, &length) < 0 || argint(2, &advice) < 0) return -1;
+    if (addr % PGSIZE != 0 || length < 0) return -1;
+    struct proc *p = myproc(); int r;
+    acquiresleep(&p->mm->lock);
+    r = vmadvise(p, addr, length, advice);
+    releasesleep(&p->mm->lock);
+    return r;
+}
+// 告诉内核以后怎么读文件的[offset, offset+length)，length为0表示到文件末尾
+uint64 sys_fadvise(void) {
+    struct file *f; int offset, length, advice;
+    if (argfd(0, 0, &f) < 0 || argint(1, &offset) < 0 || argint(2, &length) < 0 ||
+        argint(3, &advice) < 0) return -1;
+    if (offset < 0 || length < 0) return -1;
+    return fileadvise(f, offset, length, advice);
 }
 
 int
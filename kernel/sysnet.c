@@ -7,15 +7,16 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "slab.h"
 #include "defs.h"
 #include "fs.h"
-#include "sleeplock.h"
 #include "file.h"
 #include "net.h"
 
 struct sock {
-  struct sock *next; // the next socket in the list
+  struct sock *next; // the next socket in the hash bucket
   uint32 raddr;      // the remote IPv4 address
   uint16 lport;      // the local UDP port number
   uint16 rport;      // the remote UDP port number
@@ -23,25 +24,50 @@ struct sock {
   struct mbufq rxq;  // a queue of packets waiting to be received
 };
 
-static struct spinlock lock;
-static struct sock *sockets;
+// 按(raddr, lport, rport)散列，每个桶一把锁，收包时只锁一个桶
+#define NSOCKHASH 64
+
+static struct sockbucket {
+  struct spinlock lock;
+  struct sock *head;
+} socktbl[NSOCKHASH];
+
+static struct kcache sockcache;
+
+static struct sockbucket*
+sockhash(uint32 raddr, uint16 lport, uint16 rport)
+{
+  uint32 h = raddr ^ ((uint32)lport << 16 | rport);
+
+  return &socktbl[(h * 2654435761u) >> 26];
+}
+
+// 关闭的时候rxq已经清空了，所以只需要在新建slab时初始化一次
+static void
+sockctor(void *p)
+{
+  mbufq_init(&((struct sock*)p)->rxq);
+}
 
 void
 sockinit(void)
 {
-  initlock(&lock, "socktbl");
+  for (int i = 0; i < NSOCKHASH; i++)
+    initlock(&socktbl[i].lock, "sockbucket");
+  kcacheinit(&sockcache, "sock", sizeof(struct sock), sockctor);
 }
 
 int
 sockalloc(struct file **f, uint32 raddr, uint16 lport, uint16 rport)
 {
   struct sock *si, *pos;
+  struct sockbucket *b;
 
   si = 0;
   *f = 0;
   if ((*f = filealloc()) == 0)
     goto bad;
-  if ((si = (struct sock*)kalloc()) == 0)
+  if ((si = kcachealloc(&sockcache)) == 0)
     goto bad;
 
   // initialize objects
@@ -49,32 +75,32 @@ sockalloc(struct file **f, uint32 raddr, uint16 lport, uint16 rport)
   si->lport = lport;
   si->rport = rport;
   initlock(&si->lock, "sock");
-  mbufq_init(&si->rxq);
-  (*f)->type = FD_SOCK;
-  (*f)->readable = 1;
-  (*f)->writable = 1;
-  (*f)->sock = si;
 
-  // add to list of sockets
-  acquire(&lock);
-  pos = sockets;
-  while (pos) {
+  // add to the hash bucket, unless the tuple is taken
+  b = sockhash(raddr, lport, rport);
+  acquire(&b->lock);
+  for (pos = b->head; pos; pos = pos->next) {
     if (pos->raddr == raddr &&
         pos->lport == lport &&
-	pos->rport == rport) {
-      release(&lock);
+        pos->rport == rport) {
+      release(&b->lock);
       goto bad;
     }
-    pos = pos->next;
   }
-  si->next = sockets;
-  sockets = si;
-  release(&lock);
+  si->next = b->head;
+  b->head = si;
+  release(&b->lock);
+
+  // 插入以后再填file，否则上面失败时fileclose()会再释放一次si
+  (*f)->type = FD_SOCK;
+  (*f)->readable = 1;
+  (*f)->writable = 1;
+  (*f)->sock = si;
   return 0;
 
 bad:
   if (si)
-    kfree((char*)si);
+    kcachefree(&sockcache, si);
   if (*f)
     fileclose(*f);
   return -1;
@@ -83,12 +109,13 @@ bad:
 void
 sockclose(struct sock *si)
 {
+  struct sockbucket *b = sockhash(si->raddr, si->lport, si->rport);
   struct sock **pos;
   struct mbuf *m;
 
-  // remove from list of sockets
-  acquire(&lock);
-  pos = &sockets;
+  // remove from the hash bucket; after this nobody can find si any more
+  acquire(&b->lock);
+  pos = &b->head;
   while (*pos) {
     if (*pos == si){
       *pos = si->next;
@@ -96,15 +123,18 @@ sockclose(struct sock *si)
     }
     pos = &(*pos)->next;
   }
-  release(&lock);
+  release(&b->lock);
 
-  // free any pending mbufs
+  // free any pending mbufs. sockrecvudp() may still be pushing one
+  // under si->lock, so wait for it
+  acquire(&si->lock);
   while (!mbufq_empty(&si->rxq)) {
     m = mbufq_pophead(&si->rxq);
     mbuffree(m);
   }
+  release(&si->lock);
 
-  kfree((char*)si);
+  kcachefree(&sockcache, si);
 }
 
 int
@@ -163,23 +193,22 @@ sockrecvudp(struct mbuf *m, uint32 raddr, uint16 lport, uint16 rport)
   // any sleeping reader. Free the mbuf if there are no sockets
   // registered to handle it.
   //
+  struct sockbucket *b = sockhash(raddr, lport, rport);
   struct sock *si;
 
-  acquire(&lock);
-  si = sockets;
-  while (si) {
+  acquire(&b->lock);
+  for (si = b->head; si; si = si->next) {
     if (si->raddr == raddr && si->lport == lport && si->rport == rport)
-      goto found;
-    si = si->next;
+      break;
+  }
+  if (si == 0) {
+    release(&b->lock);
+    mbuffree(m);
+    return;
   }
-  release(&lock);
-  mbuffree(m);
-  return;
-
-found:
   acquire(&si->lock);
+  release(&b->lock);
   mbufq_pushtail(&si->rxq, m);
   wakeup(&si->rxq);
   release(&si->lock);
-  release(&lock);
 }
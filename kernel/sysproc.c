@@ -5,8 +5,10 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "sysinfo.h"
+#include "fcntl.h"
 
 extern uint64 nproc();
 extern uint64 nfree();
@@ -33,6 +35,33 @@ sys_fork(void)
   return fork();
 }
 
+// 创建和当前进程共享地址空间的线程，见proc.c的clone()
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+// futex(addr, op, val)，见futex.c
+uint64
+sys_futex(void)
+{
+  uint64 addr;
+  int op, val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  if(op == FUTEX_WAIT)
+    return futexwait(addr, val);
+  if(op == FUTEX_WAKE)
+    return futexwake(addr, val);
+  return -1;
+}
+
 uint64
 sys_wait(void)
 {
@@ -42,27 +71,48 @@ sys_wait(void)
   return wait(p);
 }
 
-uint64
-sys_sbrk(void)
+// sbrk的公共部分，flags是MAP_POPULATE的话预先分配新的内存
+static uint64
+dosbrk(int n, int flags)
 {
   int addr;
-  int n;
-
-  if(argint(0, &n) < 0)
-    return -1;
 
   struct proc *p = myproc();
-  addr = p->sz;
+  acquiresleep(&p->mm->lock);
+  addr = p->mm->sz;
   if (n < 0) {
      if(growproc(n) < 0)
-        return -1;
+        addr = -1;
   }
   else {
-    p->sz += n;
+    p->mm->sz += n;
+    if (flags & MAP_POPULATE)
+      populate(p, addr, p->mm->sz, 1);
   }
+  releasesleep(&p->mm->lock);
   return addr;
 }
 
+uint64
+sys_sbrk(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return dosbrk(n, 0);
+}
+
+uint64
+sys_sbrkf(void)
+{
+  int n, flags;
+
+  if(argint(0, &n) < 0 || argint(1, &flags) < 0)
+    return -1;
+  return dosbrk(n, flags);
+}
+
 uint64
 sys_sleep(void)
 {
@@ -145,9 +195,21 @@ uint64 sys_sigalarm(void) {
     return 0;
 }
 
+// 按用户栈上的寄存器帧恢复，内核用的字段保持不变。
+// 返回恢复的a0，免得syscall()把它覆盖掉。
 uint64 sys_sigreturn(void) {
     struct proc *p = myproc();
+    struct trapframe tf;
+
+    if (p->duration != -1)
+        return -1;
+    if (copyin(p->pagetable, (char*)&tf, p->sigframe, sizeof(tf)) < 0)
+        return -1;
+    tf.kernel_satp = p->trapframe->kernel_satp;
+    tf.kernel_sp = p->trapframe->kernel_sp;
+    tf.kernel_trap = p->trapframe->kernel_trap;
+    tf.kernel_hartid = p->trapframe->kernel_hartid;
+    *p->trapframe = tf;
     p->duration = 0;
-    *p->trapframe = p->state_time;
-    return 0;
+    return tf.a0;
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -44,6 +45,9 @@ usertrap(void)
   w_stvec((uint64)kernelvec);
 
   struct proc *p = myproc();
+
+  // 在用户态的时候别的线程可能改了地址空间
+  tlbpoll();
   
   // 保存用户程序计数
   p->trapframe->epc = r_sepc();
@@ -66,9 +70,9 @@ usertrap(void)
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
-    if (r_scause() == 13 || r_scause() == 15) {
+    if (r_scause() == 12 || r_scause() == 13 || r_scause() == 15) {
           uint64 va = r_stval(); 
-          if (handle_pagefault(va, p) ==  -1) 
+          if (handle_pagefault(va, p, r_scause() == 15) ==  -1) 
             p->killed = 1;
       } else {
           printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
@@ -86,8 +90,17 @@ usertrap(void)
       if (p->ticks > 0 && p->duration > -1) {
           p->duration++;
           if (p->duration >= p->ticks) {
+              // 被打断的寄存器放在用户栈上，地址作为处理函数的参数，
+              // 处理函数可以改它（比如用户态线程库切换线程），sigreturn()按它恢复
+              struct trapframe tf = *p->trapframe;
+              uint64 sp = (tf.sp - sizeof(tf)) & ~0xfL;
+              tf.kernel_satp = tf.kernel_sp = tf.kernel_trap = tf.kernel_hartid = 0;
+              if (copyout(p->pagetable, sp, (char*)&tf, sizeof(tf)) < 0)
+                  exit(-1);
               p->duration = -1;
-              p->state_time = *p->trapframe;
+              p->sigframe = sp;
+              p->trapframe->sp = sp;
+              p->trapframe->a0 = sp;
               p->trapframe->epc = p->handler;
               intr_on();
           } else yield();
@@ -115,7 +128,7 @@ usertrapret(void)
   w_stvec(TRAMPOLINE + (uservec - trampoline));
 
   // 设置trapframe的值方便进程下次进入内核时uservec能用到
-  p->trapframe->kernel_satp = r_satp();         // 内核页表
+  p->trapframe->kernel_satp = r_satp();         // 内核也用进程的页表
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // 进程内核栈
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();         // 读取tp放入trapframe，这样方便用户态回到内核态时，再放回到tp，方便函数cpuid()使用
@@ -131,12 +144,12 @@ usertrapret(void)
   // 把保存的用户pc设置回sepc（S Exception Program Counter）
   w_sepc(p->trapframe->epc);
 
-  // 告诉trampoline.S 要切换的用户页表
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // 告诉trampoline.S 要切换的用户页表，就是现在用的这个（带着ASID）
+  uint64 satp = r_satp();
 
   // 跳回 trampoline.S，那里会切换会用户页表，恢复用户寄存器，和通过sret返回到用户模式
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->trapframeva, satp);
 }
 
 // 发生在内核的中断和异常通过kernelvec来到这里
@@ -154,13 +167,16 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
+  // 别的hart可能在等这个hart清TLB，见uvmflush()
+  tlbpoll();
+
   if((which_dev = devintr()) != 0){
     //ok
   }else {
     struct proc *p = myproc();
-    if (r_scause() == 13 || r_scause() == 15) {
+    if (p != 0 && (r_scause() == 13 || r_scause() == 15)) {
           uint64 va = r_stval(); 
-          if (handle_kpagefault(va, p) == -1) {
+          if (handle_kpagefault(va, p, r_scause() == 15) == -1) {
             p->killed = 1;
             exit(-1);
           }
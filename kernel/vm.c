@@ -3,6 +3,9 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -10,6 +13,9 @@
  * 内核页表.
  */
 pagetable_t kernel_pagetable;
+struct spinlock ptlock;   // 保护共享页表页的引用计数和内容，见ptunshare()
+
+static pte_t *walklevel(pagetable_t, uint64, int, int);
 
 extern char etext[];  // kernel.ld 会设置这个在内核代码结束那里.
 
@@ -24,26 +30,29 @@ kvmmake(void)
   kpgtbl = (pagetable_t) kalloc();
   memset(kpgtbl, 0, PGSIZE);
 
+  // 设备寄存器都映射在DEVBASE上面
+  // [KERNBASE, KVMTOP)在所有页表里都一样（见uvmkmap()），标成全局的，
+  // 切换地址空间时它们的TLB项不用清掉
   // uart 寄存器
-  kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, UART0, UART0 - DEVBASE, PGSIZE, PTE_R | PTE_W | PTE_G);
 
   // virtio mmio 磁盘接口
-  kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, VIRTIO0, VIRTIO0 - DEVBASE, PGSIZE, PTE_R | PTE_W | PTE_G);
 
   // PCI-E ECAM (configuration space), for pci.c
-  kvmmap(kpgtbl, 0x30000000L, 0x30000000L, 0x10000000, PTE_R | PTE_W);
+  kvmmap(kpgtbl, DEVBASE + ECAM_PA, ECAM_PA, 0x10000000, PTE_R | PTE_W | PTE_G);
 
   // pci.c maps the e1000's registers here.
-  kvmmap(kpgtbl, 0x40000000L, 0x40000000L, 0x20000, PTE_R | PTE_W);
+  kvmmap(kpgtbl, DEVBASE + E1000_PA, E1000_PA, 0x20000, PTE_R | PTE_W | PTE_G);
 
   // PLIC
-  kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
+  kvmmap(kpgtbl, PLIC, PLIC - DEVBASE, 0x400000, PTE_R | PTE_W | PTE_G);
 
   // 映射内核可执行代码和只读的数据
-  kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
+  kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X | PTE_G);
 
   // 映射内核数据和我们将使用的物理内存
-  kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
+  kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W | PTE_G);
 
   // 将陷阱的进出用到的蹦床（trampoline）映射到内核中最高的虚拟地址。
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
@@ -59,15 +68,231 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  initlock(&ptlock, "ptshare");
 }
 
 // 将h/w页表寄存器切换到内核的页表,
 // 并启用分页。
+// 内核直接读写用户内存，所以一直打开SUM。
 void
 kvminithart()
 {
   w_satp(MAKE_SATP(kernel_pagetable));
   sfence_vma();
+  w_sstatus(r_sstatus() | SSTATUS_SUM);
+}
+
+// ASID分配器。
+// 每个地址空间有一个ASID，切换进程时不用清TLB。ASID用完了就开始新的
+// 一代(generation)：mm->asid的高位是分配时的代数，不是当前代的ASID都作废，
+// 每个hart开始用新一代的ASID之前清掉整个TLB。ASID 0留给内核页表。
+#define ASIDGEN (SATP_ASIDMASK + 1)
+
+struct {
+  struct spinlock lock;
+  uint64 gen;     // 当前的代数，ASIDGEN的倍数
+  uint64 next;    // 这一代下一个没用过的ASID
+  uint64 max;     // 硬件支持的最大ASID，0表示不支持
+} asids;
+
+// 看看硬件实现了satp里的几位ASID
+void
+asidinit(void)
+{
+  uint64 satp = r_satp();
+
+  initlock(&asids.lock, "asid");
+  w_satp(satp | (SATP_ASIDMASK << SATP_ASIDSHIFT));
+  asids.max = (r_satp() >> SATP_ASIDSHIFT) & SATP_ASIDMASK;
+  w_satp(satp);
+  sfence_vma();
+  asids.gen = ASIDGEN;
+  asids.next = 1;
+}
+
+// 在这个hart上切换到进程p的页表，调度器或者exec()里的进程自己调用。
+// 只在需要的时候清TLB：开始用新一代的ASID时清掉整个TLB；
+// 地址空间在别的hart上改过的话（mm->stale），这个hart上它的TLB项可能过时了，只清它的ASID。
+void
+uvmswitch(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  struct mm *mm = p->mm;
+  uint64 bit = 1L << cpuid();
+  int flush;
+
+  acquire(&asids.lock);
+  if((mm->asid & ~SATP_ASIDMASK) != asids.gen){
+    if(asids.next > asids.max){
+      // 用完了，开始新的一代
+      asids.gen += ASIDGEN;
+      asids.next = 1;
+    }
+    mm->asid = asids.gen | (asids.next & asids.max);
+    asids.next++;
+    mm->stale = 0;  // 新的ASID在哪个hart上都没有TLB项
+  }
+  flush = c->asidgen != asids.gen;
+  c->asidgen = asids.gen;
+  release(&asids.lock);
+
+  w_satp(MAKE_SATP_ASID(p->pagetable, mm->asid));
+  if(flush)
+    sfence_vma();
+  else if(mm->stale & bit){
+    __sync_fetch_and_and(&mm->stale, ~bit);
+    sfence_vma_asid(mm->asid & SATP_ASIDMASK);
+  }
+}
+
+// 回到内核页表（ASID 0），不用清TLB：
+// 释放了的页表的ASID在这一代里不会再用
+void
+kvmswitch(void)
+{
+  w_satp(MAKE_SATP(kernel_pagetable));
+}
+
+// 只清这个hart上当前地址空间的TLB项。
+// 只加了映射的时候用：别的hart上最多缓存了无效的项，在那边再缺页一次就好了（见pagefault()）
+void
+uvmflushhart(void)
+{
+  sfence_vma_asid((r_satp() >> SATP_ASIDSHIFT) & SATP_ASIDMASK);
+}
+
+// 当前进程p的地址空间里去掉了映射或者降低了权限，清掉所有hart上它的TLB项。
+// 没有在运行它的hart记在mm->stale里，切换过来时由uvmswitch()清；
+// 正在运行共享它的线程的hart要等它们清完，因为旧的页马上可能被释放；
+// 在mmlock()里转着等这个地址空间的hart不用等，它们拿到锁以后再清，那之前不会用到用户映射。
+// S模式下不能发处理器间中断，那些hart在下一次陷入内核或者等自旋锁的时候清（tlbpoll()），
+// 在用户态运行的话最多要等一个时钟中断。
+void
+uvmflush(struct proc *p)
+{
+  struct mm *mm = p->mm;
+  struct cpu *c, *me;
+
+  push_off();
+  me = mycpu();
+  uvmflushhart();
+  __sync_fetch_and_or(&mm->stale, ~(1L << cpuid()));
+  __sync_synchronize();
+  if(mm->ref > 1){
+    for(c = cpus; c < &cpus[NCPU]; c++)
+      if(c != me && c->proc && c->proc->mm == mm)
+        c->tlbreq = 1;
+    __sync_synchronize();
+    for(c = cpus; c < &cpus[NCPU]; c++)
+      while(c != me && c->tlbreq && c->proc && c->proc->mm == mm && c->mmwait != mm)
+        tlbpoll();
+  }
+  pop_off();
+}
+
+// 别的hart要求清TLB（见uvmflush()）的话清掉。
+// 先清请求再清TLB：中间这个hart只运行内核代码，不会用到旧的用户映射
+void
+tlbpoll(void)
+{
+  struct cpu *c = mycpu();
+
+  if(c->tlbreq){
+    c->tlbreq = 0;
+    __sync_synchronize();
+    sfence_vma();
+  }
+}
+
+// 共享页表的写时拷贝fork。
+// fork时父子进程共享[0, sz)的最后一级页表页：一级页表项清掉PTE_V、设上PTE_S，
+// 页表页的引用计数（kalloc.c）就是共享它的进程数。引用计数大于1的页表页
+// 只被PTE_S的项指着，硬件不会用它。任何一方第一次用到这2MB的时候（walk()）
+// 再分开，所以fork的代价和进程大小无关，马上exec的子进程只是放弃这些页表页。
+#define L0SPAN (1L << PXSHIFT(1))   // 一个最后一级页表页管的范围
+
+// 一级页表项pte指向共享的页表页，把它变成自己的。
+// 还有别人在共享的话复制一份，可写的页在两边都改成写时拷贝，每页多一个引用；
+// 只剩自己的话直接收回来。没有内存时返回-1。
+static int
+ptunshare(pte_t *pte)
+{
+  pagetable_t old, new = 0;
+  pte_t e;
+
+  acquire(&ptlock);
+  while((*pte & PTE_S) && krefcnt(PTE2PA(*pte)) > 1 && new == 0){
+    // 要复制，不在持有ptlock时分配
+    release(&ptlock);
+    if((new = (pagetable_t)kalloc()) == 0)
+      return -1;
+    acquire(&ptlock);
+  }
+  old = (pagetable_t)PTE2PA(*pte);
+  if((*pte & PTE_S) == 0 || krefcnt((uint64)old) == 1){
+    if(*pte & PTE_S)
+      *pte = PA2PTE(old) | PTE_V;
+    release(&ptlock);
+    if(new)
+      kfree(new);
+    return 0;
+  }
+  for(int i = 0; i < 512; i++){
+    e = old[i];
+    if(e & PTE_V){
+      if(e & PTE_W){
+        e = (e & ~PTE_W) | PTE_C;
+        old[i] = e;
+      }
+      kref(PTE2PA(e));
+    }
+    new[i] = e;
+  }
+  kfree(old);
+  *pte = PA2PTE(new) | PTE_V;
+  release(&ptlock);
+  return 0;
+}
+
+// 包含va的最后一级页表页是共享的话把它变成自己的（缺页时用），返回1；
+// 不是共享的返回0，没有内存返回-1。
+int
+uvmunshare(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  if((pte = walklevel(pagetable, va, 0, 1)) == 0 || (*pte & PTE_S) == 0)
+    return 0;
+  return ptunshare(pte) == 0 ? 1 : -1;
+}
+
+// 放弃[0, sz)里别人还在共享的页表页，释放地址空间的时候不用一页页地拆
+static void
+ptdrop(pagetable_t pagetable, uint64 sz)
+{
+  pte_t *pte;
+
+  for(uint64 a = 0; a < sz; a += L0SPAN){
+    if((pte = walklevel(pagetable, a, 0, 1)) == 0 || (*pte & PTE_S) == 0)
+      continue;
+    acquire(&ptlock);
+    if(krefcnt(PTE2PA(*pte)) > 1){
+      kfree((void*)PTE2PA(*pte));
+      *pte = 0;
+    }
+    release(&ptlock);
+  }
+}
+
+// 把内核的映射放进用户页表pagetable，内核就可以直接用进程的页表运行。
+// [KERNBASE, KVMTOP)的一级页表和内核页表共享，用PTE_K标记，
+// walk()不会进去，释放页表的时候也跳过。
+void
+uvmkmap(pagetable_t pagetable)
+{
+  for(int i = PX(2, KERNBASE); i < PX(2, KVMTOP); i++)
+    if(kernel_pagetable[i] & PTE_V)
+      pagetable[i] = kernel_pagetable[i] | PTE_K;
 }
 
 // 返回页表pagetable中PTE的地址
@@ -82,14 +307,27 @@ kvminithart()
 // 21..29 —- 一级索引的9位。
 // 12..20 —- 0级索引的9位。
 //  0..11 -— 页内字节偏移量的12位。
+//
+// walk()经过共享的页表页（PTE_S）时先把它变成自己的，见ptunshare()。
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, alloc, 0);
+}
+
+// 和walk()一样，但是只走到第to级，返回指向第to级页表项的指针
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int to)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
+  for(int level = 2; level > to; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
+    if(*pte & PTE_K)
+      return 0;  // 共享的内核映射，用户不能改
+    if((*pte & PTE_S) && ptunshare(pte) != 0)
+      return 0;
     if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
@@ -99,7 +337,7 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(to, va)];
 }
 
 // 查找虚拟地址，返回物理地址，
@@ -119,8 +357,8 @@ walkaddr(pagetable_t pagetable, uint64 va)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
-  // if((*pte & PTE_U) == 0)
-  //   return 0;
+  if((*pte & PTE_U) == 0)
+    return 0;
   pa = PTE2PA(*pte);
   return pa;
 }
@@ -192,6 +430,37 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
   }
 }
 
+// 去掉p正在用的页表里从va开始的npages页的映射并释放物理页，
+// user不为0时留着没有PTE_U的页（栈的保护页）。
+// 别的hart上共享这个地址空间的线程可能还缓存着旧的TLB项，
+// uvmflush()以前页不能释放：先攒在栈上，攒满一批清一次TLB再释放。
+void
+uvmzap(struct proc *p, uint64 va, uint64 npages, int user)
+{
+  uint64 a, pa[32];
+  pte_t *pte;
+  int n = 0;
+
+  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    if(PTE_FLAGS(*pte) == PTE_V)
+      panic("uvmzap: not a leaf");
+    if(user && (*pte & PTE_U) == 0)
+      continue;
+    pa[n++] = PTE2PA(*pte);
+    *pte = 0;
+    if(n == NELEM(pa)){
+      uvmflush(p);
+      while(n > 0)
+        kfree((void*)pa[--n]);
+    }
+  }
+  uvmflush(p);
+  while(n > 0)
+    kfree((void*)pa[--n]);
+}
+
 // 创建空的用户页表。
 // 如果内存不足，则返回0。
 pagetable_t
@@ -255,12 +524,17 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 uint64
 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
+  struct proc *p;
+
   if(newsz >= oldsz)
     return oldsz;
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
-    uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
+    if((p = myproc()) != 0 && p->pagetable == pagetable)
+      uvmzap(p, PGROUNDUP(newsz), npages, 0);  // 别的线程可能还在用
+    else
+      uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
   }
 
   return newsz;
@@ -274,7 +548,14 @@ freewalk(pagetable_t pagetable)
   // 页表中有2^9=512个PTE。
   for(int i = 0; i < 512; i++){
     pte_t pte = pagetable[i];
-    if((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) == 0){
+    if(pte & PTE_K){
+      // 共享的内核映射
+      pagetable[i] = 0;
+    } else if((pte & PTE_S) && (pte & PTE_V) == 0){
+      // 别人还在共享的页表页（只剩自己的已经被uvmunmap()收回来了）
+      kfree((void*)PTE2PA(pte));
+      pagetable[i] = 0;
+    } else if((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) == 0){
       // 此PTE指向较低级别的页表。
       uint64 child = PTE2PA(pte);
       freewalk((pagetable_t)child);
@@ -291,6 +572,7 @@ freewalk(pagetable_t pagetable)
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
+  ptdrop(pagetable, sz);
   if(sz > 0)
     uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
   freewalk(pagetable);
@@ -298,45 +580,32 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // 给定父进程的页表，复制
 // 它的内存进入孩子的页表。
-// 复制页表和
-// 物理内存。
+// 页和最后一级页表页都是写时拷贝共享的。
 // 成功时返回0，失败时返回-1。
 // 失败时释放所有分配的页。
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
-  uint64 pa, i;
-  uint flags;
-  // char *mem;
+  pte_t *pte, *npte;
+  uint64 i;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      // panic("uvmcopy: pte should exist");
+  // 不复制页，也不复制页表：父子进程共享最后一级页表页，
+  // 第一次用到的时候再分开（见ptunshare()）
+  for(i = 0; i < sz; i += L0SPAN){
+    if((pte = walklevel(old, i, 0, 1)) == 0 || (*pte & (PTE_V|PTE_S)) == 0)
       continue;
-    if((*pte & PTE_V) == 0)
-      // panic("uvmcopy: page not present");
-      continue;
-    pa = PTE2PA(*pte);
-    *pte &= ~PTE_W;
-    *pte |= PTE_C;
-    flags = PTE_FLAGS(*pte);
-    // if((mem = kalloc()) == 0)
-    //   goto err;
-    // memmove(mem, (char*)pa, PGSIZE);
-    // if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-    //   kfree(mem);
-    //   goto err;
-    // }
-    // lab cow
-    if(mappages(new, i, PGSIZE, pa, flags) != 0) 
+    if((npte = walklevel(new, i, 1, 1)) == 0)
       goto err;
-    kref(pa);
+    acquire(&ptlock);
+    kref(PTE2PA(*pte));
+    *pte = (*pte & ~PTE_V) | PTE_S;
+    *npte = *pte;
+    release(&ptlock);
   }
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  ptdrop(new, i);
   return -1;
 }
 
@@ -356,20 +625,37 @@ uvmclear(pagetable_t pagetable, uint64 va)
 // 从内核复制到用户。
 // 将len字节从src复制到给定页表中的虚拟地址dstva。
 // 成功时返回0，错误时返回-1。
+// 拿着mm->lock查页表和拷贝，这中间别的线程不能解除映射、释放这些页。
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
+  struct proc *p = myproc();
+  struct mm *mm = 0;
   uint64 n, va0, pa0;
+  pte_t *pte;
+  int r = 0;
 
+  // exec()往还没有用上的新页表里拷的时候别人看不到它，不用锁，也不会缺页
+  if(p && pagetable == p->pagetable){
+    mm = p->mm;
+    mmlock(mm);
+  }
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0) {
-        if (handle_pagefault(va0, myproc()) == -1) return -1; else pa0 = walkaddr(pagetable, va0);
-    } else {
-      if (*(walk(pagetable, va0, 0)) & PTE_C) handle_pagefault(va0, myproc());
-      pa0 = walkaddr(pagetable, va0);
+    pte = walk(pagetable, va0, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_C)){
+      if(mm == 0 || uvmfault(p, va0, 1) < 0){
+        r = -1;
+        break;
+      }
+      pte = walk(pagetable, va0, 0);
     }
+    if((*pte & PTE_W) == 0){
+      r = -1;  // 只读的映射，比如页缓存里的页
+      break;
+    }
+    *pte |= PTE_D;  // 内核写的也算脏页，mmap写回要用
+    pa0 = PTE2PA(*pte);
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -379,32 +665,9 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
     src += n;
     dstva = va0 + PGSIZE;
   }
-  return 0;
-}
-
-// 从用户复制到内核。
-// 将len字节从给定页表中的虚拟地址srcva复制到dst。
-// 成功时返回0，错误时返回-1。
-int
-_copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
-{
-  uint64 n, va0, pa0;
-
-  while(len > 0){
-    va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
-    n = PGSIZE - (srcva - va0);
-    if(n > len)
-      n = len;
-    memmove(dst, (void *)(pa0 + (srcva - va0)), n);
-
-    len -= n;
-    dst += n;
-    srcva = va0 + PGSIZE;
-  }
-  return 0;
+  if(mm)
+    releasesleep(&mm->lock);
+  return r;
 }
 
 // 将以null结尾的字符串从用户复制到内核。
@@ -450,20 +713,17 @@ _copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 //   }
 //} 
 
+// 内核开着SUM直接读用户内存，见vmcopyin.c
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
-    if(srcva >= PLIC){
-      return _copyin(pagetable,dst,srcva,len);
-    } else{
-      return copyin_new(pagetable,dst,srcva,len);
-    }
-}    
+  return copyin_new(pagetable, dst, srcva, len);
+}
 
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-    return copyinstr_new(pagetable,dst,srcva,max);
+  return copyinstr_new(pagetable, dst, srcva, max);
 }
 
 // lab page table
@@ -475,7 +735,7 @@ void printwalk(pagetable_t pt, int dep) {
             printf("..%d: pte %p ", i, pte);
             uint64 child = PTE2PA(pte);
             printf("pa %p\n", child);
-            if ((pte & (PTE_R|PTE_W|PTE_X)) == 0)
+            if ((pte & (PTE_R|PTE_W|PTE_X)) == 0 && (pte & PTE_K) == 0)
                 printwalk((pagetable_t)child, dep + 1);
         }
     }
@@ -486,90 +746,47 @@ void vmprint(pagetable_t pt) {
     printwalk(pt, 1);
 }
 
-pagetable_t proc_kpagetable(void) {
-    pagetable_t kpagetable = (pagetable_t) kalloc();
-    memset(kpagetable, 0, PGSIZE);
-
-    if (mappages(kpagetable, UART0, PGSIZE, UART0, PTE_R | PTE_W) != 0) return 0;
-    if (mappages(kpagetable, VIRTIO0, PGSIZE, VIRTIO0, PTE_R | PTE_W) != 0) return 0;
-    if (mappages(kpagetable, 0x30000000L, 0x10000000, 0x30000000L, PTE_R | PTE_W) != 0) return 0;
-    if (mappages(kpagetable, 0x40000000L, 0x20000, 0x40000000L, PTE_R | PTE_W) != 0) return 0;
-    if (mappages(kpagetable, PLIC, 0x400000, PLIC, PTE_R | PTE_W) != 0) return 0;
-    if (mappages(kpagetable, KERNBASE, (uint64)etext-KERNBASE, KERNBASE, PTE_R | PTE_X) != 0) return 0;
-    if (mappages(kpagetable, (uint64)etext, PHYSTOP-(uint64)etext, (uint64)etext, PTE_R | PTE_W) != 0) return 0;
-    if (mappages(kpagetable, TRAMPOLINE, PGSIZE, (uint64)trampoline, PTE_R | PTE_X) != 0) return 0;
-
-    return kpagetable;
-}
-int kvmcopy(pagetable_t old, pagetable_t new, uint64 st, uint64 en) {
-    pte_t *pte;
-    uint64 pa, i;
-    uint flags;
-
-    if (en >= PLIC) return -1;
-
-    st = PGROUNDUP(st);
-
-    for(i = st; i < en; i += PGSIZE) {
-        if((pte = walk(old, i, 0)) == 0)
-            // panic("kvmcopy: pte should exist");
-            continue;
-        if((*pte & PTE_V) == 0)
-            // panic("kvmcopy: page not present");
-            continue;
-        pa = PTE2PA(*pte);
-        flags = PTE_FLAGS(*pte) & (~PTE_U);
-        if(mappages(new, i, PGSIZE, (uint64)pa, flags) != 0) goto err;
-    }
+// 写时拷贝的页（PTE_C）被写了：只有自己在用的话直接改成可写，否则复制一份。
+// 成功返回0，没有内存返回-1。
+int
+cowpage(pte_t *pte)
+{
+  uint64 pa = PTE2PA(*pte);
+  uint flags = (PTE_FLAGS(*pte) & ~PTE_C) | PTE_W;
+  char *mem;
+
+  if(krefcnt(pa) == 1){
+    *pte = PA2PTE(pa) | flags;
     return 0;
-err:
-    uvmunmap(new, 0, i / PGSIZE, 0);
+  }
+  if((mem = kalloc()) == 0)
     return -1;
-}
-void proc_kfreepagetable(pagetable_t pagetable) {
-    for(int i = 0; i < 512; i++){
-        pte_t pte = pagetable[i];
-        if((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) == 0){
-            uint64 child = PTE2PA(pte);
-            proc_kfreepagetable((pagetable_t)child);
-            pagetable[i] = 0;
-        }
-    }
-    kfree((void*)pagetable);
-}
-uint64 kvmdealloc(pagetable_t kpagetable, uint64 oldsz, uint64 newsz) {
-    if(newsz >= oldsz)
-        return oldsz;
-
-    if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
-        int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
-        uvmunmap(kpagetable, PGROUNDUP(newsz), npages, 0);
-    }
-    return newsz;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE((uint64)mem) | flags;
+  kfree((void*)pa);
+  return 0;
 }
 
-int mmapcopy(pagetable_t old, pagetable_t new, uint64 sz) {
+// 把[start, end)里已经映射的mmap页复制到子进程的页表。
+// share不为0时父子共享同一个可写的物理页，否则和uvmcopy()一样写时拷贝。
+// 子进程的页不带PTE_D，脏页由父进程负责写回。
+int mmapcopy(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int share) {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
-  for(i = 1L << 37; i < (1L << 37) + sz; i += PGSIZE) {
+  for(i = start; i < end; i += PGSIZE) {
     if((pte = walk(old, i, 0)) == 0) continue;
     if((*pte & PTE_V) == 0) continue;
     pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
+    if(!share && (*pte & PTE_W)){
+      *pte &= ~PTE_W;
+      *pte |= PTE_C;
     }
+    flags = PTE_FLAGS(*pte) & ~PTE_D;
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
+      return -1;
+    kref(pa);
   }
   return 0;
-
- err:
-  uvmunmap(new, i, (i - (1L << 37)) >> PGSHIFT, 1);
-  return -1;
 }
\ No newline at end of file
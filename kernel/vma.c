@@ -0,0 +1,442 @@
+// 虚拟内存区域（VMA）。
+//
+// 每个地址空间的mmap区域和exec的段放在一棵按起始地址排序的AVL树里（mm->vmas），
+// 缺页时查找VMA是O(log n)的。mmap()在[MMAPBASE, MMAPTOP)里用首次适配
+// 找空闲的地址范围，所以munmap()掉的地址还可以再用；munmap()掉中间的一段
+// 会把VMA分成两个。
+//
+// 地址空间可能被几个线程共享（clone()），修改树和页表的时候要持有mm->lock；
+// 进程退出时最后一个线程解除所有映射，那时已经没有别人了。
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "slab.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+
+static struct kcache vmacache;
+static int nwriteback;      // vmaflush()写回过的页数，给stats设备
+
+void
+vmainit(void)
+{
+  kcacheinit(&vmacache, "vma", sizeof(struct vma), 0);
+}
+
+// 分配一个清零的VMA，没有内存时返回0
+struct vma*
+vmaalloc(void)
+{
+  struct vma *v;
+
+  if((v = kcachealloc(&vmacache)) != 0)
+    memset(v, 0, sizeof(*v));
+  return v;
+}
+
+void
+vmafree(struct vma *v)
+{
+  kcachefree(&vmacache, v);
+}
+
+// AVL树
+
+static int
+height(struct vma *t)
+{
+  return t ? t->height : 0;
+}
+
+static void
+fixheight(struct vma *t)
+{
+  int l = height(t->left), r = height(t->right);
+  t->height = 1 + (l > r ? l : r);
+}
+
+static struct vma*
+rotright(struct vma *t)
+{
+  struct vma *l = t->left;
+
+  t->left = l->right;
+  l->right = t;
+  fixheight(t);
+  fixheight(l);
+  return l;
+}
+
+static struct vma*
+rotleft(struct vma *t)
+{
+  struct vma *r = t->right;
+
+  t->right = r->left;
+  r->left = t;
+  fixheight(t);
+  fixheight(r);
+  return r;
+}
+
+static struct vma*
+balance(struct vma *t)
+{
+  int b;
+
+  fixheight(t);
+  b = height(t->left) - height(t->right);
+  if(b > 1){
+    if(height(t->left->left) < height(t->left->right))
+      t->left = rotleft(t->left);
+    return rotright(t);
+  }
+  if(b < -1){
+    if(height(t->right->right) < height(t->right->left))
+      t->right = rotright(t->right);
+    return rotleft(t);
+  }
+  return t;
+}
+
+static struct vma*
+insert(struct vma *t, struct vma *v)
+{
+  if(t == 0){
+    v->left = v->right = 0;
+    v->height = 1;
+    return v;
+  }
+  if(v->start < t->start)
+    t->left = insert(t->left, v);
+  else
+    t->right = insert(t->right, v);
+  return balance(t);
+}
+
+static struct vma*
+removemin(struct vma *t, struct vma **min)
+{
+  if(t->left == 0){
+    *min = t;
+    return t->right;
+  }
+  t->left = removemin(t->left, min);
+  return balance(t);
+}
+
+static struct vma*
+remove(struct vma *t, struct vma *v)
+{
+  struct vma *m;
+
+  if(t == 0)
+    panic("vmaremove");
+  if(v->start < t->start)
+    t->left = remove(t->left, v);
+  else if(v->start > t->start)
+    t->right = remove(t->right, v);
+  else {
+    if(t->right == 0)
+      return t->left;
+    t->right = removemin(t->right, &m);
+    m->left = t->left;
+    m->right = t->right;
+    return balance(m);
+  }
+  return balance(t);
+}
+
+void
+vmainsert(struct vma **root, struct vma *v)
+{
+  *root = insert(*root, v);
+}
+
+void
+vmaremove(struct vma **root, struct vma *v)
+{
+  *root = remove(*root, v);
+}
+
+// 返回第一个end > addr的VMA，没有的话返回0
+struct vma*
+vmafind(struct vma *t, uint64 addr)
+{
+  struct vma *best = 0;
+
+  while(t){
+    if(t->end > addr){
+      best = t;
+      t = t->left;
+    } else {
+      t = t->right;
+    }
+  }
+  return best;
+}
+
+// 返回包含va的VMA
+struct vma*
+vmalookup(struct vma *t, uint64 va)
+{
+  struct vma *v = vmafind(t, va);
+
+  if(v && v->start <= va)
+    return v;
+  return 0;
+}
+
+// 在[lo, hi)里首次适配找一段len字节的空闲地址，没有的话返回0
+uint64
+vmagap(struct vma *t, uint64 len, uint64 lo, uint64 hi)
+{
+  struct vma *v;
+  uint64 a = lo;
+
+  for(v = vmafind(t, a); v; v = vmafind(t, v->end)){
+    if(v->start >= a + len)
+      break;
+    a = v->end;
+  }
+  if(a + len > hi || a + len < a)
+    return 0;
+  return a;
+}
+
+// 映射上的操作
+
+// 把[start, end)里写过（PTE_D）的页写回v映射的文件，
+// 只写文件大小以内的部分，匿名映射什么都不做。
+// 所有页尽量放在同一个事务里，日志空间用完了writei()会提前返回，这时提交再开一个事务接着写。
+int
+vmaflush(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  struct inode *ip = v->ip;
+  uint64 a, pa;
+  pte_t *pte;
+  uint off;
+  int n, r, inop = 0;
+
+  if(ip == 0)
+    return 0;
+  for(a = start; a < end; a += PGSIZE){
+    if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+      continue;
+    *pte &= ~PTE_D;
+    if(!inop){
+      begin_op();
+      ilock(ip);
+      inop = 1;
+    }
+    off = a - v->start + v->off;
+    if(off >= ip->size)
+      continue;
+    n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+    pa = PTE2PA(*pte);
+    __atomic_add_fetch(&nwriteback, 1, __ATOMIC_RELAXED);
+    while((r = writei(ip, 0, pa, off, n)) < n){
+      if(r < 0){
+        iunlock(ip);
+        end_op();
+        uvmflush(p);
+        return -1;
+      }
+      pa += r;
+      off += r;
+      n -= r;
+      iunlock(ip);
+      end_op();
+      begin_op();
+      ilock(ip);
+    }
+  }
+  if(inop){
+    iunlock(ip);
+    end_op();
+  }
+  uvmflush(p);
+  return 0;
+}
+
+// 给stats设备
+int
+statsvma(char *buf, int sz)
+{
+  return snprintf(buf, sz, "--- mmap: writeback %d\n", nwriteback);
+}
+
+// 把[addr, addr+len)里MAP_SHARED映射的脏页写回文件。
+// 范围里没有映射的话返回-1。
+int
+vmasync(struct proc *p, uint64 addr, uint64 len)
+{
+  struct vma *v;
+  uint64 end = addr + len;
+  int found = 0;
+
+  for(v = vmafind(p->mm->vmas, addr); v && v->start < end; v = vmafind(p->mm->vmas, v->end)){
+    found = 1;
+    if((v->flags & MAP_SHARED) &&
+       vmaflush(p, v, addr > v->start ? addr : v->start, end < v->end ? end : v->end) < 0)
+      return -1;
+  }
+  return found ? 0 : -1;
+}
+
+// 去掉[start, end)里已经映射的用户页。没有PTE_U的是栈的保护页，要留着
+static void
+vmazap(struct proc *p, uint64 start, uint64 end)
+{
+  uvmzap(p, start, (end - start) / PGSIZE, 1);
+}
+
+// 解除[addr, addr+len)里的映射，MAP_SHARED的脏页先写回文件。
+// 只覆盖VMA一部分的时候截短它，在中间的话分成两个。
+// 分裂需要新的VMA但是没有内存时返回-1。
+int
+vmaunmap(struct proc *p, uint64 addr, uint64 len)
+{
+  struct vma *v, *w;
+  uint64 s, e, end = addr + len;
+
+  while((v = vmafind(p->mm->vmas, addr)) != 0 && v->start < end){
+    s = addr > v->start ? addr : v->start;
+    e = end < v->end ? end : v->end;
+    w = 0;
+    if(v->start < s && e < v->end && (w = vmaalloc()) == 0)
+      return -1;
+    if(v->flags & MAP_SHARED)
+      vmaflush(p, v, s, e);
+    vmazap(p, s, e);
+
+    if(w){
+      // 挖掉中间的一段，后面的部分变成一个新的VMA
+      *w = *v;
+      w->start = e;
+      w->off = v->off + (e - v->start);
+      if(w->ip)
+        idup(w->ip);
+      v->end = s;
+      vmainsert(&p->mm->vmas, w);
+    } else if(s == v->start && e == v->end){
+      vmaremove(&p->mm->vmas, v);
+      if(v->ip){
+        begin_op();
+        iput(v->ip);
+        end_op();
+      }
+      vmafree(v);
+    } else if(s == v->start){
+      // 起始地址变大不会改变在树里的顺序
+      v->off += e - v->start;
+      v->start = e;
+    } else {
+      v->end = s;
+    }
+    addr = e;
+  }
+  return 0;
+}
+
+// 对堆里[start, end)这段没有VMA的内存做madvise()。
+// WILLNEED当成读缺页，只读的页也能映射，匿名页先映射零页
+static void
+heapadvise(struct proc *p, uint64 start, uint64 end, int advice)
+{
+  if(advice == MADV_WILLNEED)
+    populate(p, start, end, 0);
+  else if(advice == MADV_DONTNEED)
+    vmazap(p, start, end);
+  else
+    p->mm->heapadv = advice;
+}
+
+// madvise()。[addr, addr+len)可以覆盖堆（[0, sz)）和mmap区域。
+// NORMAL、RANDOM和SEQUENTIAL记在整个VMA（或者整个堆）上，不分裂VMA；
+// WILLNEED马上映射还没有映射的页；DONTNEED马上释放页，MAP_SHARED的脏页先写回，
+// 以后再访问的时候重新缺页（私有的匿名内存又是零）。
+int
+vmadvise(struct proc *p, uint64 addr, uint64 len, int advice)
+{
+  struct vma *v;
+  uint64 a, s, e, end = PGROUNDUP(addr + len);
+
+  if(advice < MADV_NORMAL || advice > MADV_DONTNEED || end < addr)
+    return -1;
+  if(addr < p->mm->sz){
+    // exec的段在堆的下面，有自己的VMA，由后面的循环处理
+    e = end < PGROUNDUP(p->mm->sz) ? end : PGROUNDUP(p->mm->sz);
+    for(a = addr; a < e; a = v->end){
+      v = vmafind(p->mm->vmas, a);
+      s = v && v->start < e ? v->start : e;
+      if(a < s)
+        heapadvise(p, a, s, advice);
+      if(s == e)
+        break;
+    }
+  }
+  for(v = vmafind(p->mm->vmas, addr); v && v->start < end; v = vmafind(p->mm->vmas, v->end)){
+    s = addr > v->start ? addr : v->start;
+    e = end < v->end ? end : v->end;
+    if(advice == MADV_WILLNEED)
+      populate(p, s, e, 0);
+    else if(advice == MADV_DONTNEED){
+      if(v->ip == 0 && (v->flags & MAP_SHARED))
+        continue;  // 共享的匿名内存没有地方可以写回
+      if(v->flags & MAP_SHARED)
+        vmaflush(p, v, s, e);
+      vmazap(p, s, e);
+    } else
+      v->advice = advice;
+  }
+  return 0;
+}
+
+// 释放树里所有的VMA，不管页表（exec失败时用）
+void
+vmafreeall(struct vma **root)
+{
+  struct vma *v;
+
+  begin_op();
+  while((v = *root) != 0){
+    vmaremove(root, v);
+    if(v->ip)
+      iput(v->ip);
+    vmafree(v);
+  }
+  end_op();
+}
+
+// fork时把p的VMA和已经映射的页复制给np。
+// MAP_SHARED映射父子共享物理页，私有映射写时拷贝。
+int
+vmafork(struct proc *p, struct proc *np)
+{
+  struct vma *v, *w;
+  int share;
+
+  for(v = vmafind(p->mm->vmas, 0); v; v = vmafind(p->mm->vmas, v->end)){
+    if((w = vmaalloc()) == 0)
+      return -1;
+    *w = *v;
+    if(w->ip)
+      idup(w->ip);
+    vmainsert(&np->mm->vmas, w);
+    // exec的段在[0, sz)里，页已经被uvmcopy()复制了
+    if(v->start < MMAPBASE)
+      continue;
+    share = (v->flags & MAP_SHARED) != 0;
+    if(mmapcopy(p->pagetable, np->pagetable, v->start, v->end, share) < 0)
+      return -1;
+  }
+  return 0;
+}
@@ -3,12 +3,17 @@
 #include "riscv.h"
 #include "defs.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "memlayout.h"
 #include "proc.h"
 
 //
 // This file contains copyin_new() and copyinstr_new(), the
 // replacements for copyin and coyinstr in vm.c.
 //
+// 内核用进程自己的页表运行并且打开了SUM，所以可以直接读用户地址；
+// 还没有映射的页由kerneltrap()处理缺页。
+//
 
 static struct stats {
   int ncopyin;
@@ -23,6 +28,39 @@ statscopyin(char *buf, int sz) {
   return n;
 }
 
+// 用户地址va开始的一段能读到哪里：堆是sz，mmap区域是VMA的末尾，
+// 不是用户地址的话返回va。[KERNBASE, KVMTOP)是内核的映射。
+// 别的线程可能同时munmap()释放VMA树的节点，所以有别的线程时拿着mm->lock看树。
+// spin表示调用者持有自旋锁，不能等这个锁：这时不看树，由uvmprefault()在锁里检查。
+// 结果只是一个上界，访问的时候页已经没有映射了的话在缺页时失败。
+static uint64
+ulimit(struct proc *p, uint64 va, int spin)
+{
+  struct mm *mm = p->mm;
+  struct vma *v;
+  uint64 end = va;
+
+  if(va < mm->sz)
+    end = mm->sz;
+  else if(spin)
+    end = KERNBASE;
+  else if(mm->ref == 1){
+    // 只有自己一个线程，树不会变
+    if((v = vmalookup(mm->vmas, va)) != 0)
+      end = v->end;
+  } else {
+    acquiresleep(&mm->lock);
+    if((v = vmalookup(mm->vmas, va)) != 0)
+      end = v->end;
+    releasesleep(&mm->lock);
+  }
+  if(va < KERNBASE && end > KERNBASE)
+    end = KERNBASE;
+  if(va >= KERNBASE && va < KVMTOP)
+    end = va;
+  return end;
+}
+
 // Copy from user to kernel.
 // Copy len bytes to dst from virtual address srcva in a given page table.
 // Return 0 on success, -1 on error.
@@ -30,13 +68,19 @@ int
 copyin_new(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   struct proc *p = myproc();
+  int spin = holdingspin();
 
-  if (srcva >= p->sz || srcva+len > p->sz || srcva+len < srcva)
+  if (srcva+len < srcva || srcva+len > ulimit(p, srcva, spin))
    {
         return -1;
    } 
    
+  // 持有自旋锁的话缺页不能睡眠，先映射好，映射不了就失败
+  if (spin && uvmprefault(p, srcva, len) < 0)
+    return -1;
   memmove((void *) dst, (void *)srcva, len);
+  if (spin)
+    releasesleep(&p->mm->lock);
   stats.ncopyin++;   // XXX lock
   return 0;
 }
@@ -50,12 +94,25 @@ copyinstr_new(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   struct proc *p = myproc();
   char *s = (char *) srcva;
+  int spin = holdingspin(), locked = 0, r = -1;
+  uint64 end = ulimit(p, srcva, spin);
 
   stats.ncopyinstr++;   // XXX lock
-  for(int i = 0; i < max && srcva + i < p->sz; i++){
+  for(int i = 0; i < max && srcva + i < end; i++){
+    // 持有自旋锁的话一页一页地先映射好
+    if(spin && (i == 0 || (srcva + i) % PGSIZE == 0)){
+      if(locked)
+        releasesleep(&p->mm->lock);
+      if(!(locked = uvmprefault(p, srcva + i, 1) == 0))
+        break;
+    }
     dst[i] = s[i];
-    if(s[i] == '\0')
-      return 0;
+    if(s[i] == '\0'){
+      r = 0;
+      break;
+    }
   }
-  return -1;
-}
\ No newline at end of file
+  if(locked)
+    releasesleep(&p->mm->lock);
+  return r;
+}
@@ -0,0 +1,75 @@
+//
+// notxv6/barrier.c的xv6版本：N个线程（clone()）反复通过同一个屏障，
+// 检查每个线程看到的轮数都对。屏障在sync.c里，用futex()睡眠。
+// 用法：barrier [线程数]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NROUND 20000
+#define STACKSIZE 4096
+
+static int nthread = 1;
+static struct barrier bstate;
+
+static unsigned long randstate = 1;
+
+static int
+rand(void)
+{
+  randstate = randstate * 1103515245 + 12345;
+  return (randstate / 65536) % 0x7fffffff;
+}
+
+static void
+thread(void *xa)
+{
+  volatile int delay;
+
+  for(int i = 0; i < NROUND; i++){
+    int t = bstate.round;
+    if(i != t){
+      fprintf(2, "barrier: thread %d round %d, expected %d\n", (int)(uint64)xa, t, i);
+      exit(1);
+    }
+    barrier_wait(&bstate);
+    // 代替usleep(random() % 100)，让线程错开一点
+    for(delay = rand() % 100; delay > 0; delay--)
+      ;
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, xstatus, failed = 0;
+  char *stack;
+
+  nthread = argc > 1 ? atoi(argv[1]) : 2;
+  if(nthread <= 0){
+    fprintf(2, "usage: barrier nthread\n");
+    exit(1);
+  }
+  barrier_init(&bstate, nthread);
+
+  for(i = 0; i < nthread; i++){
+    if((stack = malloc(STACKSIZE)) == 0 ||
+       clone(thread, (void*)(uint64)i, stack + STACKSIZE) < 0){
+      fprintf(2, "barrier: clone failed\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < nthread; i++){
+    if(wait(&xstatus) < 0 || xstatus != 0)
+      failed = 1;
+  }
+  if(failed){
+    printf("barrier: FAILED\n");
+    exit(1);
+  }
+  printf("OK; passed\n");
+  exit(0);
+}
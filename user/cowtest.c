@@ -177,6 +177,76 @@ filetest()
   printf("ok\n");
 }
 
+// fork shares the last-level page-table pages; check that
+// every process still sees its own data after parents,
+// children and grandchildren write to the shared ranges.
+void
+sharedpttest()
+{
+  int sz = 8 * 1024 * 1024;
+  int pid;
+
+  printf("sharedpt: ");
+
+  char *p = sbrk(sz);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("sbrk(%d) failed\n", sz);
+    exit(-1);
+  }
+  for(char *q = p; q < p + sz; q += 4096)
+    *(int*)q = 1;
+
+  pid = fork();
+  if(pid < 0){
+    printf("fork() failed\n");
+    exit(-1);
+  }
+  if(pid == 0){
+    // a child that only exits drops the shared tables.
+    if(fork() == 0)
+      exit(0);
+    wait(0);
+    if(fork() == 0){
+      for(char *q = p; q < p + sz/2; q += 4096)
+        *(int*)q = 3;
+      for(char *q = p; q < p + sz/2; q += 4096)
+        if(*(int*)q != 3)
+          exit(-1);
+      exit(0);
+    }
+    for(char *q = p + sz/2; q < p + sz; q += 4096)
+      *(int*)q = 2;
+    int xstatus;
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(-1);
+    for(char *q = p; q < p + sz; q += 4096)
+      if(*(int*)q != (q < p + sz/2 ? 1 : 2))
+        exit(-1);
+    exit(0);
+  }
+
+  int xstatus;
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("child saw wrong data\n");
+    exit(-1);
+  }
+  for(char *q = p; q < p + sz; q += 4096){
+    if(*(int*)q != 1){
+      printf("child overwrote parent\n");
+      exit(-1);
+    }
+  }
+
+  if(sbrk(-sz) == (char*)0xffffffffffffffffL){
+    printf("sbrk(-%d) failed\n", sz);
+    exit(-1);
+  }
+
+  printf("ok\n");
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -191,6 +261,8 @@ main(int argc, char *argv[])
 
   filetest();
 
+  sharedpttest();
+
   printf("ALL COW TESTS PASSED\n");
 
   exit(0);
@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
 
 #define REGION_SZ (1024 * 1024 * 1024)
 
@@ -73,6 +74,53 @@ sparse_memory_unmap(char *s)
   exit(0);
 }
 
+// 只读的懒分配内存都映射到同一个零页，不应该占用物理内存
+void
+zero_page(char *s)
+{
+  struct sysinfo before, after;
+  char *i, *prev_end, *new_end;
+  uint64 sum = 0;
+  int n = REGION_SZ / 16;
+
+  sysinfo(&before);
+  prev_end = sbrk(n);
+  if (prev_end == (char*)0xffffffffffffffffL) {
+    printf("sbrk() failed\n");
+    exit(1);
+  }
+  new_end = prev_end + n;
+
+  for (i = prev_end; i < new_end; i += PGSIZE)
+    sum += *(uint64*)i;
+  if (sum != 0) {
+    printf("lazy memory not zero\n");
+    exit(1);
+  }
+  sysinfo(&after);
+  // 只有页表页
+  if (before.freemem - after.freemem > 256 * PGSIZE) {
+    printf("reading used %d pages\n", (before.freemem - after.freemem) / PGSIZE);
+    exit(1);
+  }
+
+  // 写一页只复制那一页，其他页还是零
+  before = after;
+  prev_end[PGSIZE] = 1;
+  sysinfo(&after);
+  if (before.freemem - after.freemem > 4 * PGSIZE) {
+    printf("writing one page used %d pages\n", (before.freemem - after.freemem) / PGSIZE);
+    exit(1);
+  }
+  if (prev_end[0] != 0 || prev_end[2 * PGSIZE] != 0 || prev_end[PGSIZE] != 1) {
+    printf("zero page modified\n");
+    exit(1);
+  }
+
+  sbrk(-n);
+  exit(0);
+}
+
 void
 oom(char *s)
 {
@@ -132,6 +180,7 @@ main(int argc, char *argv[])
   } tests[] = {
     { sparse_memory, "lazy alloc"},
     { sparse_memory_unmap, "lazy unmap"},
+    { zero_page, "zero page"},
     { oom, "out of memory"},
     { 0, 0},
   };
@@ -0,0 +1,175 @@
+//
+// malloc()的性能测试：随机地分配和释放大小不同的块（大多数是小块），
+// 比较umalloc.c和以前的K&R分配器（复制在下面）的速度和堆的大小。
+// 每个分配器在一个子进程里跑，堆的大小用sbrk(0)量。
+// 用法：mallocbench [次数]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NITER 200000
+#define NLIVE 1000          // 同时存在的块
+#define SAMPLE 1024         // 每隔多少次看一下堆的大小
+
+// 以前umalloc.c里的K&R分配器
+typedef long Align;
+
+union header {
+  struct {
+    union header *ptr;
+    uint size;
+  } s;
+  Align x;
+};
+
+typedef union header Header;
+
+static Header base;
+static Header *freep;
+
+static void
+kr_free(void *ap)
+{
+  Header *bp, *p;
+
+  bp = (Header*)ap - 1;
+  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
+    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
+      break;
+  if(bp + bp->s.size == p->s.ptr){
+    bp->s.size += p->s.ptr->s.size;
+    bp->s.ptr = p->s.ptr->s.ptr;
+  } else
+    bp->s.ptr = p->s.ptr;
+  if(p + p->s.size == bp){
+    p->s.size += bp->s.size;
+    p->s.ptr = bp->s.ptr;
+  } else
+    p->s.ptr = bp;
+  freep = p;
+}
+
+static Header*
+morecore(uint nu)
+{
+  char *p;
+  Header *hp;
+
+  if(nu < 4096)
+    nu = 4096;
+  p = sbrk(nu * sizeof(Header));
+  if(p == (char*)-1)
+    return 0;
+  hp = (Header*)p;
+  hp->s.size = nu;
+  kr_free((void*)(hp + 1));
+  return freep;
+}
+
+static void*
+kr_malloc(uint nbytes)
+{
+  Header *p, *prevp;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if((prevp = freep) == 0){
+    base.s.ptr = freep = prevp = &base;
+    base.s.size = 0;
+  }
+  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
+    if(p->s.size >= nunits){
+      if(p->s.size == nunits)
+        prevp->s.ptr = p->s.ptr;
+      else {
+        p->s.size -= nunits;
+        p += p->s.size;
+        p->s.size = nunits;
+      }
+      freep = prevp;
+      return (void*)(p + 1);
+    }
+    if(p == freep)
+      if((p = morecore(nunits)) == 0)
+        return 0;
+  }
+}
+
+static unsigned long randstate = 1;
+
+static int
+rand(void)
+{
+  randstate = randstate * 1103515245 + 12345;
+  return (randstate / 65536) % 0x7fffffff;
+}
+
+// 十个里九个是256字节以内的小块，剩下的最大16KB
+static uint
+randsize(void)
+{
+  if(rand() % 10)
+    return 1 + rand() % 256;
+  return 1 + rand() % 16384;
+}
+
+static void
+run(char *name, void *(*alloc)(uint), void (*release)(void*), int n)
+{
+  static char *live[NLIVE];
+  char *start = sbrk(0), *top;
+  int i, j, t0, t1;
+  uint64 peak = 0;
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    j = rand() % NLIVE;
+    if(live[j]){
+      release(live[j]);
+      live[j] = 0;
+    } else {
+      uint sz = randsize();
+      if((live[j] = alloc(sz)) == 0){
+        fprintf(2, "mallocbench: %s: out of memory\n", name);
+        exit(1);
+      }
+      live[j][0] = live[j][sz-1] = 1;
+    }
+    if(i % SAMPLE == 0 && (top = sbrk(0)) - start > peak)
+      peak = top - start;
+  }
+  t1 = uptime();
+  for(j = 0; j < NLIVE; j++){
+    if(live[j])
+      release(live[j]);
+  }
+  printf("%s: %d ops %d ticks", name, n, t1 - t0);
+  if(t1 > t0)
+    printf(" (%d ops/tick)", n / (t1 - t0));
+  printf(", peak heap %d KB, after freeing all %d KB\n",
+         (int)(peak / 1024), (int)((sbrk(0) - start) / 1024));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = argc > 1 ? atoi(argv[1]) : NITER;
+
+  if(n <= 0){
+    fprintf(2, "usage: mallocbench [iterations]\n");
+    exit(1);
+  }
+  if(fork() == 0){
+    run("K&R first-fit", kr_malloc, kr_free, n);
+    exit(0);
+  }
+  wait(0);
+  if(fork() == 0){
+    run("size classes", malloc, free, n);
+    exit(0);
+  }
+  wait(0);
+  exit(0);
+}
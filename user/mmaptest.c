@@ -7,7 +7,11 @@
 #include "user/user.h"
 
 void mmap_test();
+void munmap_test();
 void fork_test();
+void madvise_test();
+void msync_test();
+void populate_test();
 char buf[BSIZE];
 
 #define MAP_FAILED ((char *) -1)
@@ -16,7 +20,11 @@ int
 main(int argc, char *argv[])
 {
   mmap_test();
+  munmap_test();
   fork_test();
+  madvise_test();
+  msync_test();
+  populate_test();
   printf("mmaptest: all tests succeeded\n");
   exit(0);
 }
@@ -295,3 +303,273 @@ fork_test(void)
   printf("fork_test OK\n");
 }
 
+//
+// madvise() and fadvise() hints.
+//
+void
+madvise_test(void)
+{
+  int fd, i;
+  char *p;
+  const char * const f = "mmap.dur";
+
+  printf("madvise_test starting\n");
+  testname = "madvise_test";
+
+  // DONTNEED on anonymous memory drops the contents.
+  p = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    err("mmap anon");
+  if (madvise(p, PGSIZE*2, MADV_SEQUENTIAL) < 0)
+    err("madvise sequential");
+  p[0] = 'x';
+  p[PGSIZE] = 'y';
+  if (madvise(p, PGSIZE*2, MADV_DONTNEED) < 0)
+    err("madvise dontneed");
+  if (p[0] != 0 || p[PGSIZE] != 0)
+    err("anon memory not dropped");
+  munmap(p, PGSIZE*2);
+
+  // DONTNEED on a shared file mapping writes dirty pages back first.
+  makefile(f);
+  if ((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  p = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    err("mmap shared");
+  if (madvise(p, PGSIZE*2, MADV_WILLNEED) < 0)
+    err("madvise willneed");
+  for (i = 0; i < PGSIZE; i++)
+    p[i] = 'Z';
+  if (madvise(p, PGSIZE*2, MADV_DONTNEED) < 0)
+    err("madvise dontneed (2)");
+  if (p[0] != 'Z' || p[PGSIZE] != 'A')
+    err("file mapping lost data");
+  munmap(p, PGSIZE*2);
+
+  // fadvise() only changes caching, never the data read.
+  if (fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) < 0)
+    err("fadvise dontneed");
+  if (fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) < 0)
+    err("fadvise willneed");
+  if (fadvise(fd, 0, 0, POSIX_FADV_NOREUSE) < 0)
+    err("fadvise noreuse");
+  for (i = 0; i < PGSIZE + PGSIZE/2; i += BSIZE) {
+    if (read(fd, buf, BSIZE) != BSIZE)
+      err("read");
+    if (buf[0] != (i < PGSIZE ? 'Z' : 'A'))
+      err("fadvise changed data");
+  }
+  if (fadvise(fd, 0, 0, 42) != -1)
+    err("bad advice accepted");
+  close(fd);
+
+  printf("madvise_test OK\n");
+}
+
+//
+// read a counter from the statistics device: the number
+// after "name ", e.g. "writeback" or "faults".
+//
+int
+counter(char *name)
+{
+  static char sbuf[4096+1];
+  char *c;
+  int n, len = strlen(name);
+
+  if ((n = statistics(sbuf, sizeof(sbuf)-1)) <= 0)
+    err("statistics");
+  sbuf[n] = 0;
+  for (c = sbuf; *c; c++)
+    if (memcmp(c, name, len) == 0 && c[len] == ' ')
+      return atoi(c + len + 1);
+  err("no such counter");
+  return -1;
+}
+
+//
+// msync() writes back only the dirty pages of a shared mapping.
+//
+void
+msync_test(void)
+{
+  int fd, i, j, n0, n1;
+  char *p;
+  const char * const f = "mmap.dur";
+
+  printf("msync_test starting\n");
+  testname = "msync_test";
+
+  makefile(f);
+  if ((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  p = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    err("mmap");
+
+  // fault in both pages, but dirty only the second one.
+  _v1(p);
+  for (i = PGSIZE; i < PGSIZE + PGSIZE/2; i++)
+    p[i] = 'B';
+  n0 = counter("writeback");
+  if (msync(p, PGSIZE*2, MS_SYNC) < 0)
+    err("msync");
+  n1 = counter("writeback");
+  if (n1 - n0 != 1) {
+    printf("wrote back %d pages, wanted 1\n", n1 - n0);
+    err("msync wrote back clean pages");
+  }
+
+  // the page is clean again, so neither msync() nor munmap()
+  // has anything left to write.
+  if (msync(p, PGSIZE*2, MS_SYNC) < 0)
+    err("msync (2)");
+  if (munmap(p, PGSIZE*2) == -1)
+    err("munmap");
+  if (counter("writeback") != n1)
+    err("clean page written back");
+
+  // drop the cached pages so that read() sees what is on disk.
+  if (fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) < 0)
+    err("fadvise dontneed");
+  for (i = 0; i < PGSIZE + PGSIZE/2; i += BSIZE) {
+    if (read(fd, buf, BSIZE) != BSIZE)
+      err("read");
+    for (j = 0; j < BSIZE; j++)
+      if (buf[j] != (i < PGSIZE ? 'A' : 'B'))
+        err("file does not match the mapping");
+  }
+  close(fd);
+
+  // nothing is mapped there any more.
+  if (msync(p, PGSIZE*2, MS_SYNC) != -1)
+    err("msync on an unmapped range succeeded");
+
+  printf("msync_test OK\n");
+}
+
+//
+// MAP_POPULATE maps the whole range up front, for mmap() and sbrkf().
+//
+void
+populate_test(void)
+{
+  int i, n0, pid, xstatus;
+  char *p, *q;
+  int big = 1024*1024*1024;
+
+  printf("populate_test starting\n");
+  testname = "populate_test";
+
+  // the statistics buffer itself may fault in the first time.
+  counter("faults");
+  n0 = counter("faults");
+  p = mmap(0, PGSIZE*4, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (p == MAP_FAILED)
+    err("mmap");
+  q = sbrkf(PGSIZE*4, MAP_POPULATE);
+  if (q == (char*)-1)
+    err("sbrkf");
+  for (i = 0; i < PGSIZE*4; i += PGSIZE) {
+    p[i] = 'p';
+    q[i] = 'q';
+  }
+  if (counter("faults") != n0)
+    err("populated pages faulted");
+  munmap(p, PGSIZE*4);
+  sbrk(-PGSIZE*4);
+
+  // running out of memory half way leaves the rest of the
+  // range to be faulted in on demand, and the process alive.
+  if ((pid = fork()) < 0)
+    err("fork");
+  if (pid == 0) {
+    if ((p = sbrkf(big, MAP_POPULATE)) == (char*)-1)
+      err("sbrkf big");
+    p[0] = 'x';
+    if (sbrk(-big) == (char*)-1)
+      err("sbrk shrink");
+    if ((q = sbrkf(PGSIZE, MAP_POPULATE)) == (char*)-1)
+      err("sbrkf after running out of memory");
+    q[0] = 'y';
+    exit(0);
+  }
+  if (wait(&xstatus) != pid || xstatus != 0)
+    err("process not usable after running out of memory");
+
+  printf("populate_test OK\n");
+}
+
+//
+// does touching p kill the process? try it in a child.
+//
+int
+unmapped(char *p)
+{
+  int pid, xstatus;
+
+  if ((pid = fork()) < 0)
+    err("fork");
+  if (pid == 0) {
+    *(volatile char *)p;
+    exit(0);
+  }
+  if (wait(&xstatus) != pid)
+    err("wait");
+  return xstatus != 0;
+}
+
+//
+// munmap() of part of a mapping: a hole in the middle splits it,
+// an end trims it, and mmap() reuses the freed addresses.
+//
+void
+munmap_test(void)
+{
+  int i;
+  char *p, *q;
+
+  printf("munmap_test starting\n");
+  testname = "munmap_test";
+
+  p = mmap(0, PGSIZE*4, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    err("mmap");
+  for (i = 0; i < 4; i++)
+    p[i*PGSIZE] = 'a' + i;
+
+  // split: pages 0 and 2-3 stay mapped.
+  if (munmap(p + PGSIZE, PGSIZE) == -1)
+    err("munmap middle");
+  if (!unmapped(p + PGSIZE))
+    err("hole still mapped");
+  if (p[0] != 'a' || p[2*PGSIZE] != 'c' || p[3*PGSIZE] != 'd')
+    err("split lost data");
+
+  // trim the front of the first part and the end of the second.
+  if (munmap(p, PGSIZE) == -1)
+    err("munmap front");
+  if (munmap(p + 3*PGSIZE, PGSIZE) == -1)
+    err("munmap end");
+  if (!unmapped(p) || !unmapped(p + 3*PGSIZE))
+    err("trimmed page still mapped");
+  if (p[2*PGSIZE] != 'c')
+    err("trim lost data");
+
+  // the two free pages below page 2 are the first gap that fits.
+  q = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (q == MAP_FAILED)
+    err("mmap (2)");
+  if (q > p)
+    err("freed gap not reused");
+  q[0] = 'x';
+  q[PGSIZE] = 'y';
+  if (q[0] != 'x' || q[PGSIZE] != 'y' || p[2*PGSIZE] != 'c')
+    err("reused gap");
+  munmap(q, PGSIZE*2);
+  munmap(p + 2*PGSIZE, PGSIZE);
+
+  printf("munmap_test OK\n");
+}
@@ -0,0 +1,156 @@
+//
+// notxv6/ph.c的xv6版本：多个线程（clone()）并发地往哈希表里插入键，
+// 再并发地查找，看多个hart上的线程能不能加快速度。
+// 每个桶一个互斥锁（sync.c，用futex()睡眠）。xv6的malloc()不能多个线程同时用，
+// 所以每个线程用预先分好的表项。
+// 用法：ph [线程数]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NBUCKET 5
+#define NKEYS 100000
+#define STACKSIZE 4096
+
+struct entry {
+  int key;
+  int value;
+  struct entry *next;
+};
+struct entry *table[NBUCKET];
+struct entry entries[NKEYS];
+struct mutex locks[NBUCKET];
+int keys[NKEYS];
+int nthread = 1;
+
+static unsigned long randstate = 1;
+
+static int
+rand(void)
+{
+  randstate = randstate * 1103515245 + 12345;
+  return (randstate / 65536) % 0x7fffffff;
+}
+
+static void
+put(int key, int value, struct entry *n)
+{
+  int i = key % NBUCKET;
+  struct entry *e;
+
+  mutex_lock(&locks[i]);
+  for(e = table[i]; e != 0; e = e->next){
+    if(e->key == key)
+      break;
+  }
+  if(e){
+    // 已经有这个键了，更新值
+    e->value = value;
+  } else {
+    n->key = key;
+    n->value = value;
+    n->next = table[i];
+    table[i] = n;
+  }
+  mutex_unlock(&locks[i]);
+}
+
+static struct entry*
+get(int key)
+{
+  int i = key % NBUCKET;
+  struct entry *e;
+
+  for(e = table[i]; e != 0; e = e->next){
+    if(e->key == key)
+      break;
+  }
+  return e;
+}
+
+static void
+put_thread(void *xa)
+{
+  int n = (int)(uint64)xa;
+  int b = NKEYS/nthread;
+
+  for(int i = 0; i < b; i++)
+    put(keys[b*n + i], n, &entries[b*n + i]);
+  exit(0);
+}
+
+static void
+get_thread(void *xa)
+{
+  int n = (int)(uint64)xa;
+  int missing = 0;
+
+  for(int i = 0; i < NKEYS; i++){
+    if(get(keys[i]) == 0)
+      missing++;
+  }
+  printf("%d: %d keys missing\n", n, missing);
+  exit(0);
+}
+
+// 每个线程一个栈，跑fn(i)，等它们都退出，返回用的时间
+static int
+run(void (*fn)(void*), char **stacks)
+{
+  int t0 = uptime();
+
+  for(int i = 0; i < nthread; i++){
+    if(clone(fn, (void*)(uint64)i, stacks[i] + STACKSIZE) < 0){
+      fprintf(2, "ph: clone failed\n");
+      exit(1);
+    }
+  }
+  for(int i = 0; i < nthread; i++){
+    if(wait(0) < 0){
+      fprintf(2, "ph: wait failed\n");
+      exit(1);
+    }
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char **stacks;
+  int t;
+
+  nthread = argc > 1 ? atoi(argv[1]) : 1;
+  if(nthread <= 0 || NKEYS % nthread != 0){
+    fprintf(2, "usage: ph nthreads (dividing %d)\n", NKEYS);
+    exit(1);
+  }
+  stacks = malloc(sizeof(char*) * nthread);
+  for(int i = 0; i < nthread; i++){
+    if((stacks[i] = malloc(STACKSIZE)) == 0){
+      fprintf(2, "ph: out of memory\n");
+      exit(1);
+    }
+  }
+  for(int i = 0; i < NBUCKET; i++)
+    mutex_init(&locks[i]);
+  for(int i = 0; i < NKEYS; i++)
+    keys[i] = rand();
+
+  // 先插入
+  t = run(put_thread, stacks);
+  printf("%d puts, %d ticks", NKEYS, t);
+  if(t > 0)
+    printf(", %d puts/tick", NKEYS / t);
+  printf("\n");
+
+  // 再查找
+  t = run(get_thread, stacks);
+  printf("%d gets, %d ticks", NKEYS*nthread, t);
+  if(t > 0)
+    printf(", %d gets/tick", NKEYS*nthread / t);
+  printf("\n");
+  exit(0);
+}
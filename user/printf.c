@@ -6,10 +6,174 @@
 
 static char digits[] = "0123456789ABCDEF";
 
+// 每个文件描述符一个缓冲。默认fd 1是控制台的话按行缓冲，否则满了再写；
+// fd 0的输入有缓冲；别的fd不缓冲，除非调用setvbuf()。
+// fork()、exec()、spawn()和exit()之前都会fflushall()（见ulib.c）。
+// 输入的缓冲给gets()和getc()用。
+// clone()的线程共用这些缓冲，输出的缓冲由stdiolock保护，一次printf()的输出不会被别的线程打断。
+#define NSTREAM 16    // 同NOFILE
+#define BUFSIZ 512
+
+struct stream {
+  int mode;           // 还没定的话是-1
+  int n;              // 输出缓冲里的字节数
+  char buf[BUFSIZ];
+  int rpos, rlen;     // 输入缓冲里读到哪了，一共多少
+  char rbuf[BUFSIZ];
+};
+
+static struct stream streams[NSTREAM];
+static int inited;
+struct mutex stdiolock;
+
+static struct stream*
+stream(int fd)
+{
+  struct stat st;
+
+  if(fd < 0 || fd >= NSTREAM)
+    return 0;
+  if(!inited){
+    for(int i = 0; i < NSTREAM; i++)
+      streams[i].mode = -1;
+    inited = 1;
+  }
+  if(streams[fd].mode == -1){
+    if(fd == 0)
+      streams[fd].mode = BUF_FULL;
+    else if(fd != 1)
+      streams[fd].mode = BUF_NONE;
+    else if(fstat(fd, &st) == 0 && st.type == T_DEVICE)
+      streams[fd].mode = BUF_LINE;
+    else
+      streams[fd].mode = BUF_FULL;
+  }
+  return &streams[fd];
+}
+
+// 调用者持有stdiolock
+static int
+flush(int fd)
+{
+  struct stream *s;
+  int n, off = 0;
+
+  if(fd < 0 || fd >= NSTREAM || !inited)
+    return 0;
+  s = &streams[fd];
+  n = s->n;
+  s->n = 0;
+  while(off < n){
+    int r = write(fd, s->buf + off, n - off);
+    if(r <= 0)
+      return -1;
+    off += r;
+  }
+  return 0;
+}
+
+// 设置fd的缓冲方式，先写出缓冲的输出，丢掉缓冲的输入。
+// 输入设成BUF_NONE的话一次只读一个字节，不会多读（比如sh从文件读命令，子进程还要接着读）。
+// 有缓冲的fd关掉之前要fflush()，再打开的话要重新setvbuf()
+void
+setvbuf(int fd, int mode)
+{
+  struct stream *s;
+
+  mutex_lock(&stdiolock);
+  if((s = stream(fd)) != 0){
+    flush(fd);
+    s->rpos = s->rlen = 0;
+    s->mode = mode;
+  }
+  mutex_unlock(&stdiolock);
+}
+
+int
+fflush(int fd)
+{
+  int r;
+
+  mutex_lock(&stdiolock);
+  r = flush(fd);
+  mutex_unlock(&stdiolock);
+  return r;
+}
+
+void
+fflushall(void)
+{
+  mutex_lock(&stdiolock);
+  for(int fd = 0; fd < NSTREAM && inited; fd++){
+    if(streams[fd].n > 0)
+      flush(fd);
+  }
+  mutex_unlock(&stdiolock);
+}
+
+// 调用者持有stdiolock
 static void
 putc(int fd, char c)
 {
-  write(fd, &c, 1);
+  struct stream *s = stream(fd);
+
+  if(s == 0 || s->mode == BUF_NONE){
+    write(fd, &c, 1);
+    return;
+  }
+  s->buf[s->n++] = c;
+  if(s->n >= BUFSIZ || (s->mode == BUF_LINE && c == '\n'))
+    flush(fd);
+}
+
+// 读一个字节，文件结束或者出错返回-1。
+// 读之前把fd 1的输出写出去，提示符就能先显示出来
+int
+getc(int fd)
+{
+  struct stream *s;
+  char c;
+
+  mutex_lock(&stdiolock);
+  s = stream(fd);
+  mutex_unlock(&stdiolock);
+
+  if(s == 0 || s->mode == BUF_NONE){
+    fflush(1);
+    return read(fd, &c, 1) == 1 ? (uchar)c : -1;
+  }
+  if(s->rpos >= s->rlen){
+    fflush(1);
+    s->rpos = 0;
+    if((s->rlen = read(fd, s->rbuf, BUFSIZ)) <= 0){
+      s->rlen = 0;
+      return -1;
+    }
+  }
+  return (uchar)s->rbuf[s->rpos++];
+}
+
+// 读一行（包括换行符）到buf
+char*
+fgets(int fd, char *buf, int max)
+{
+  int i, c;
+
+  for(i = 0; i+1 < max; ){
+    if((c = getc(fd)) < 0)
+      break;
+    buf[i++] = c;
+    if(c == '\n' || c == '\r')
+      break;
+  }
+  buf[i] = '\0';
+  return buf;
+}
+
+char*
+gets(char *buf, int max)
+{
+  return fgets(0, buf, max);
 }
 
 static void
@@ -54,6 +218,7 @@ vprintf(int fd, const char *fmt, va_list ap)
   char *s;
   int c, i, state;
 
+  mutex_lock(&stdiolock);
   state = 0;
   for(i = 0; fmt[i]; i++){
     c = fmt[i] & 0xff;
@@ -92,6 +257,7 @@ vprintf(int fd, const char *fmt, va_list ap)
       state = 0;
     }
   }
+  mutex_unlock(&stdiolock);
 }
 
 void
@@ -52,6 +52,74 @@ struct backcmd {
 int fork1(void);  // Fork 但如果错误则，恐慌(panic)
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
+
+// 只由命令、重定向和管道组成的命令可以不fork，直接spawn()
+int
+canspawn(struct cmd *cmd)
+{
+  switch(cmd->type){
+  case EXEC:
+    return ((struct execcmd*)cmd)->argv[0] != 0;
+  case REDIR:
+    return canspawn(((struct redircmd*)cmd)->cmd);
+  case PIPE:
+    return canspawn(((struct pipecmd*)cmd)->left) &&
+           canspawn(((struct pipecmd*)cmd)->right);
+  }
+  return 0;
+}
+
+// 用spawn()运行cmd，子进程的标准输入输出是fds[0..2]。
+// 返回启动的进程数，调用者要等待它们。
+int
+spawncmd(struct cmd *cmd, int *fds)
+{
+  int p[2], nfds[3], fd, n;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  switch(cmd->type){
+  default:
+    panic("spawncmd");
+
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(spawn(ecmd->argv[0], ecmd->argv, fds) < 0){
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    memmove(nfds, fds, sizeof(nfds));
+    nfds[rcmd->fd] = fd;
+    n = spawncmd(rcmd->cmd, nfds);
+    close(fd);
+    return n;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0)
+      panic("pipe");
+    memmove(nfds, fds, sizeof(nfds));
+    nfds[1] = p[1];
+    n = spawncmd(pcmd->left, nfds);
+    memmove(nfds, fds, sizeof(nfds));
+    nfds[0] = p[0];
+    n += spawncmd(pcmd->right, nfds);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+  return 0;
+}
 
 // 执行命令，不会返回
 void
@@ -145,7 +213,9 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  static int stdfds[3] = { 0, 1, 2 };
+  struct cmd *cmd;
+  int fd, n;
 
   // 保证这三个文件描述符是打开的
   while((fd = open("console", O_RDWR)) >= 0){
@@ -154,6 +224,8 @@ main(void)
       break;
     }
   }
+  // 命令一个字节一个字节地读，不多读，从文件读命令的时候子进程还能接着读后面的
+  setvbuf(0, BUF_NONE);
 
   // 读取和运行输入命令
   while(getcmd(buf, sizeof(buf)) >= 0){
@@ -164,9 +236,18 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    if(canspawn(cmd)){
+      // 不用先复制shell再exec
+      for(n = spawncmd(cmd, stdfds); n > 0; n--)
+        wait(0);
+    } else {
+      if(fork1() == 0)
+        runcmd(cmd);
+      wait(0);
+    }
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -324,18 +405,36 @@ struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
 struct cmd *nulterminate(struct cmd*);
 
+// 解析在shell自己里进行（为了spawn），语法错误不能退出，
+// 记下来由parsecmd()返回0
+int syntaxerr;
+
+void
+syntax(char *s)
+{
+  if(!syntaxerr)
+    fprintf(2, "%s\n", s);
+  syntaxerr = 1;
+}
+
+// 有语法错误时返回0
 struct cmd*
 parsecmd(char *s)
 {
   char *es;
   struct cmd *cmd;
 
+  syntaxerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !syntaxerr){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(syntaxerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +478,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +506,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +534,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -491,3 +598,27 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// 释放解析出来的命令，shell自己解析的命令用完要释放
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+  case LIST:
+    // pipecmd和listcmd的布局一样
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
@@ -0,0 +1,125 @@
+//
+// 套接字收包的性能测试：打开很多UDP套接字，在其中NWIN个上面
+// 轮流给主机的echo server（make server）发包、收回应，算每秒收发多少个包。
+// 比较只开NWIN个套接字和开很多个的时候，看内核按(raddr, lport, rport)找套接字的开销。
+// 每个进程最多NOFILE个文件，多出来的套接字由子进程打开，一直开着到测完。
+// 用法：sockbench [套接字数 [包数]]
+//
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/net.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define MAXSOCK 88          // 全系统NFILE个文件，留一些给别人
+#define NPKT 2000
+#define NWIN 8              // 同时在路上的包，不超过e1000的接收环
+#define PERCHILD (NOFILE - 4)
+#define LPORT 3000
+#define HZ 10               // 在qemu里一个tick大概1/10秒
+
+static uint32 dst = (10 << 24) | (0 << 16) | (2 << 8) | (2 << 0);   // 10.0.2.2，就是主机
+
+static int
+sock(int i)
+{
+  int fd;
+
+  if((fd = connect(dst, LPORT + i, NET_TESTS_PORT)) < 0){
+    fprintf(2, "sockbench: connect() %d failed\n", i);
+    exit(1);
+  }
+  return fd;
+}
+
+// 子进程打开端口[from, to)的套接字，等父进程关掉管道再退出
+static int
+holder(int from, int to)
+{
+  int p[2], pid;
+  char c;
+
+  if(pipe(p) < 0){
+    fprintf(2, "sockbench: pipe() failed\n");
+    exit(1);
+  }
+  if((pid = fork()) < 0){
+    fprintf(2, "sockbench: fork() failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    // 关掉继承来的套接字和别的子进程的管道，不然文件不够，父进程关管道也没用
+    for(int fd = 3; fd < NOFILE; fd++)
+      if(fd != p[0])
+        close(fd);
+    for(int i = from; i < to; i++)
+      sock(i);
+    read(p[0], &c, 1);
+    exit(0);
+  }
+  close(p[0]);
+  return p[1];
+}
+
+static void
+run(int nsock, int npkt)
+{
+  char *obuf = "a message from sockbench";
+  char ibuf[128];
+  int fds[NWIN], hold[MAXSOCK / PERCHILD + 1];
+  int i, j, w, nhold = 0, t0, t1;
+
+  for(i = 0; i < NWIN; i++)
+    fds[i] = sock(i);
+  for(i = NWIN; i < nsock; i += PERCHILD)
+    hold[nhold++] = holder(i, i + PERCHILD < nsock ? i + PERCHILD : nsock);
+  // 等子进程都打开了再开始计时
+  sleep(2);
+
+  t0 = uptime();
+  for(i = 0; i < npkt; i += w){
+    w = npkt - i < NWIN ? npkt - i : NWIN;
+    for(j = 0; j < w; j++){
+      if(write(fds[j], obuf, strlen(obuf)) < 0){
+        fprintf(2, "sockbench: write() failed\n");
+        exit(1);
+      }
+    }
+    for(j = 0; j < w; j++){
+      if(read(fds[j], ibuf, sizeof(ibuf)) <= 0){
+        fprintf(2, "sockbench: read() failed\n");
+        exit(1);
+      }
+    }
+  }
+  t1 = uptime();
+
+  for(i = 0; i < NWIN; i++)
+    close(fds[i]);
+  for(i = 0; i < nhold; i++){
+    close(hold[i]);
+    wait(0);
+  }
+  printf("%d sockets: %d packets %d ticks", nsock, npkt, t1 - t0);
+  if(t1 > t0)
+    printf(" (%d pps)", npkt * HZ / (t1 - t0));
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nsock = argc > 1 ? atoi(argv[1]) : 64;
+  int npkt = argc > 2 ? atoi(argv[2]) : NPKT;
+
+  if(nsock < NWIN || nsock > MAXSOCK || npkt <= 0){
+    fprintf(2, "usage: sockbench [nsockets (%d-%d) [npackets]]\n", NWIN, MAXSOCK);
+    exit(1);
+  }
+  printf("sockbench: echo server on port %d\n", NET_TESTS_PORT);
+  run(NWIN, npkt);
+  if(nsock > NWIN)
+    run(nsock, npkt);
+  exit(0);
+}
@@ -0,0 +1,67 @@
+//
+// 创建进程的性能测试：fork()+exec()和spawn()各启动一个马上退出的程序
+// （就是spawnbench自己，带参数-x）若干次，比较用的时间。
+// 父进程的内存越大fork()越贵，所以先用sbrk()把父进程撑大一些。
+// 用法：spawnbench [次数 [父进程的MB数]]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NITER 200
+#define MB (1024*1024)
+
+char *args[] = { "spawnbench", "-x", 0 };
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, mb, t0, t1, t2;
+  char *p;
+
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit(0);
+
+  n = argc > 1 ? atoi(argv[1]) : NITER;
+  mb = argc > 2 ? atoi(argv[2]) : 16;
+  if(n <= 0 || mb < 0){
+    fprintf(2, "usage: spawnbench [iterations [MB]]\n");
+    exit(1);
+  }
+  if((p = sbrk(mb * MB)) == (char*)-1){
+    fprintf(2, "spawnbench: sbrk failed\n");
+    exit(1);
+  }
+  for(i = 0; i < mb * MB; i += 4096)
+    p[i] = 1;
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "spawnbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(args[0], args);
+      fprintf(2, "spawnbench: exec failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  t1 = uptime();
+  for(i = 0; i < n; i++){
+    if(spawn(args[0], args, 0) < 0){
+      fprintf(2, "spawnbench: spawn failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  t2 = uptime();
+
+  printf("spawnbench: %d processes, parent %d MB\n", n, mb);
+  printf("fork+exec: %d ticks\n", t1 - t0);
+  printf("spawn: %d ticks\n", t2 - t1);
+  exit(0);
+}
@@ -0,0 +1,63 @@
+//
+// 上下文切换的性能测试：父子进程通过一对管道来回传一个字节，
+// 每个来回至少要两次切换（读管道的进程睡眠，写的一方唤醒它）。
+// 用法：switchbench [来回次数]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NROUND 10000
+
+int
+main(int argc, char *argv[])
+{
+  int ptoc[2], ctop[2];
+  int i, n, pid, t0, t1;
+  char c = 'x';
+
+  n = argc > 1 ? atoi(argv[1]) : NROUND;
+  if(n <= 0){
+    fprintf(2, "usage: switchbench [rounds]\n");
+    exit(1);
+  }
+  if(pipe(ptoc) < 0 || pipe(ctop) < 0){
+    fprintf(2, "switchbench: pipe failed\n");
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "switchbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(ptoc[1]);
+    close(ctop[0]);
+    for(i = 0; i < n; i++){
+      if(read(ptoc[0], &c, 1) != 1 || write(ctop[1], &c, 1) != 1){
+        fprintf(2, "switchbench: child pipe error\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+
+  close(ptoc[0]);
+  close(ctop[1]);
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    if(write(ptoc[1], &c, 1) != 1 || read(ctop[0], &c, 1) != 1){
+      fprintf(2, "switchbench: parent pipe error\n");
+      exit(1);
+    }
+  }
+  t1 = uptime();
+  wait(0);
+
+  printf("switchbench: %d round trips in %d ticks\n", n, t1 - t0);
+  if(t1 > t0)
+    printf("switchbench: %d round trips per tick\n", n / (t1 - t0));
+  exit(0);
+}
@@ -0,0 +1,103 @@
+//
+// 用futex()实现的互斥锁、条件变量和屏障。
+// 没有竞争的时候只用原子操作，不进内核；要等的时候在futex上睡眠。
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+// 0 -> 1拿到锁；否则把状态改成2（有人在等）再睡眠，
+// 醒来以后也按2拿锁，因为可能还有别人在等
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex(&m->state, FUTEX_WAIT, 2);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+// 状态是2的话可能有人在等，唤醒一个
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    m->state = 0;
+    __sync_synchronize();
+    futex(&m->state, FUTEX_WAKE, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// 先记下seq再放锁，之后有人signal的话seq变了，futex()不会睡眠。
+// 醒来不代表条件成立，调用者要在循环里检查。
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = c->seq;
+
+  mutex_unlock(m);
+  futex(&c->seq, FUTEX_WAIT, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex(&c->seq, FUTEX_WAKE, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex(&c->seq, FUTEX_WAKE, 0x7fffffff);
+}
+
+void
+barrier_init(struct barrier *b, int nthread)
+{
+  mutex_init(&b->lock);
+  cond_init(&b->cv);
+  b->nthread = nthread;
+  b->count = 0;
+  b->round = 0;
+}
+
+// 等到nthread个线程都调用了barrier_wait()，然后一起进入下一轮
+void
+barrier_wait(struct barrier *b)
+{
+  int round;
+
+  mutex_lock(&b->lock);
+  round = b->round;
+  if(++b->count == b->nthread){
+    b->count = 0;
+    b->round++;
+    cond_broadcast(&b->cv);
+  } else {
+    while(b->round == round)
+      cond_wait(&b->cv, &b->lock);
+  }
+  mutex_unlock(&b->lock);
+}
@@ -0,0 +1,262 @@
+//
+// fork-join的并行任务：task_spawn()把任务放进当前工作线程的队列，
+// task_sync()等它做完。每个工作线程（clone()出来的，共享地址空间）
+// 一个Chase-Lev双端队列：自己在底部放和取，别的线程从顶部偷。
+// 等待的线程不闲着，去执行自己或者别人队列里的任务。
+// 找不到任务的线程在futex上睡眠，有新任务时被唤醒。
+//
+// 当前工作线程的指针放在tp寄存器里，用户程序不用tp。
+// 任务结构由调用者提供（一般在栈上），不用malloc()，因为malloc()不能多个线程同时用。
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NWORKER 8
+#define DEQSIZE 256           // 队列满了的话task_spawn()直接执行任务
+#define STACKSIZE (64*1024)
+#define NSPIN 100             // 睡眠前找几轮任务
+
+struct worker {
+  long top;                   // 别的线程从这里偷
+  long bottom;                // 自己在这里放和取
+  struct task *buf[DEQSIZE];
+  uint64 rand;                // 选偷哪个线程
+  int nsteal;
+} __attribute__((aligned(64)));
+
+static struct worker workers[NWORKER];
+static char *stacks[NWORKER];
+static int nworker;
+static volatile int stop;
+static int nidle;             // 在睡眠或者准备睡眠的线程数
+static int wakeseq;           // 有新任务时加一，空闲的线程在它上面睡眠
+
+static inline struct worker*
+self(void)
+{
+  struct worker *w;
+
+  asm volatile("mv %0, tp" : "=r" (w));
+  return w;
+}
+
+static inline void
+setself(struct worker *w)
+{
+  asm volatile("mv tp, %0" : : "r" (w));
+}
+
+// 放到底部，满了返回0
+static int
+push(struct worker *w, struct task *x)
+{
+  long b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+  long t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+
+  if(b - t >= DEQSIZE)
+    return 0;
+  __atomic_store_n(&w->buf[b % DEQSIZE], x, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+// 从底部取。只剩一个的时候和偷的线程竞争top
+static struct task*
+pop(struct worker *w)
+{
+  long b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED) - 1;
+  long t;
+  struct task *x;
+
+  __atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+  if(t > b){
+    __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+  x = __atomic_load_n(&w->buf[b % DEQSIZE], __ATOMIC_RELAXED);
+  if(t == b){
+    if(!__atomic_compare_exchange_n(&w->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+      x = 0;
+    __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+  return x;
+}
+
+// 从顶部偷，空的或者没抢到返回0
+static struct task*
+steal(struct worker *w)
+{
+  long t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+  long b;
+  struct task *x;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+  if(t >= b)
+    return 0;
+  x = __atomic_load_n(&w->buf[t % DEQSIZE], __ATOMIC_RELAXED);
+  if(!__atomic_compare_exchange_n(&w->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    return 0;
+  return x;
+}
+
+// 先取自己的，再从随机的一个线程开始挨个偷
+static struct task*
+findtask(struct worker *w)
+{
+  struct task *x;
+  int i, v;
+
+  if((x = pop(w)) != 0)
+    return x;
+  if(nworker == 1)
+    return 0;
+  w->rand ^= w->rand << 13;
+  w->rand ^= w->rand >> 7;
+  w->rand ^= w->rand << 17;
+  v = w->rand % nworker;
+  for(i = 0; i < nworker; i++, v = (v + 1) % nworker){
+    if(&workers[v] == w)
+      continue;
+    if((x = steal(&workers[v])) != 0){
+      w->nsteal++;
+      return x;
+    }
+  }
+  return 0;
+}
+
+static int
+haswork(void)
+{
+  for(int i = 0; i < nworker; i++){
+    if(__atomic_load_n(&workers[i].top, __ATOMIC_ACQUIRE) <
+       __atomic_load_n(&workers[i].bottom, __ATOMIC_ACQUIRE))
+      return 1;
+  }
+  return 0;
+}
+
+static void
+runtask(struct task *x)
+{
+  x->fn(x->arg);
+  __atomic_store_n(&x->done, 1, __ATOMIC_RELEASE);
+}
+
+// 先记下wakeseq再登记成空闲，然后再看一遍有没有任务：
+// 放任务的一方先放再看nidle，所以两边至少有一方看得到对方
+static void
+idle(void)
+{
+  int seq = __atomic_load_n(&wakeseq, __ATOMIC_ACQUIRE);
+
+  __atomic_add_fetch(&nidle, 1, __ATOMIC_SEQ_CST);
+  if(!stop && !haswork())
+    futex(&wakeseq, FUTEX_WAIT, seq);
+  __atomic_sub_fetch(&nidle, 1, __ATOMIC_SEQ_CST);
+}
+
+static void
+worker(void *arg)
+{
+  struct worker *w = arg;
+  struct task *x;
+  int spin = 0;
+
+  setself(w);
+  while(!stop){
+    if((x = findtask(w)) != 0){
+      runtask(x);
+      spin = 0;
+    } else if(++spin >= NSPIN){
+      idle();
+      spin = 0;
+    }
+  }
+  exit(0);
+}
+
+// 启动nworker个工作线程，调用者自己是第0个。
+// 之后调用者直接执行根任务，用完了调用task_exit()
+int
+task_init(int n)
+{
+  if(n < 1 || n > NWORKER)
+    return -1;
+  nworker = n;
+  stop = 0;
+  nidle = 0;
+  for(int i = 0; i < NWORKER; i++){
+    workers[i].top = workers[i].bottom = 0;
+    workers[i].rand = i + 1;
+    workers[i].nsteal = 0;
+  }
+  setself(&workers[0]);
+  for(int i = 1; i < n; i++){
+    if(stacks[i] == 0 && (stacks[i] = malloc(STACKSIZE)) == 0)
+      return -1;
+    if(clone(worker, &workers[i], stacks[i] + STACKSIZE) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// 让别的线程停下来并等它们退出。它们是调用者的子进程，用wait()等
+void
+task_exit(void)
+{
+  stop = 1;
+  __atomic_add_fetch(&wakeseq, 1, __ATOMIC_SEQ_CST);
+  futex(&wakeseq, FUTEX_WAKE, NWORKER);
+  for(int i = 1; i < nworker; i++)
+    wait(0);
+  nworker = 0;
+}
+
+// 在当前工作线程上放一个任务fn(arg)，之后要用task_sync()等它
+void
+task_spawn(struct task *x, void (*fn)(void*), void *arg)
+{
+  x->fn = fn;
+  x->arg = arg;
+  x->done = 0;
+  if(!push(self(), x)){
+    runtask(x);
+    return;
+  }
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&nidle, __ATOMIC_RELAXED) > 0){
+    __atomic_add_fetch(&wakeseq, 1, __ATOMIC_SEQ_CST);
+    futex(&wakeseq, FUTEX_WAKE, 1);
+  }
+}
+
+// 等x做完。x还在自己的队列里的话自己执行，被偷走了就去执行别的任务
+void
+task_sync(struct task *x)
+{
+  struct worker *w = self();
+  struct task *y;
+
+  while(!__atomic_load_n(&x->done, __ATOMIC_ACQUIRE)){
+    if((y = findtask(w)) != 0)
+      runtask(y);
+  }
+}
+
+// 一共偷了多少次任务
+int
+task_steals(void)
+{
+  int n = 0;
+
+  for(int i = 0; i < NWORKER; i++)
+    n += workers[i].nsteal;
+  return n;
+}
@@ -52,24 +52,6 @@ strchr(const char *s, char c)
   return 0;
 }
 
-char*
-gets(char *buf, int max)
-{
-  int i, cc;
-  char c;
-
-  for(i=0; i+1 < max; ){
-    cc = read(0, &c, 1);
-    if(cc < 1)
-      break;
-    buf[i++] = c;
-    if(c == '\n' || c == '\r')
-      break;
-  }
-  buf[i] = '\0';
-  return buf;
-}
-
 int
 stat(const char *n, struct stat *st)
 {
@@ -134,3 +116,39 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// 有printf.c的话先把缓冲的输出写出去。forktest不链接printf.c，
+// 所以用弱引用，没有的时候是0
+void fflushall(void) __attribute__((weak));
+
+int
+fork(void)
+{
+  if(fflushall)
+    fflushall();
+  return _fork();
+}
+
+int
+exec(char *path, char **argv)
+{
+  if(fflushall)
+    fflushall();
+  return _exec(path, argv);
+}
+
+int
+spawn(char *path, char **argv, int *fds)
+{
+  if(fflushall)
+    fflushall();
+  return _spawn(path, argv, fds);
+}
+
+int
+exit(int status)
+{
+  if(fflushall)
+    fflushall();
+  _exit(status);
+}
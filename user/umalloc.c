@@ -3,88 +3,218 @@
 #include "user/user.h"
 #include "kernel/param.h"
 
-// Kernighan和Ritchie的内存分配器，
-// C程序设计语言，第2版，第8.7节。
+// 按大小分类的内存分配器。
+//
+// 不超过MAXSMALL的请求向上取到一个大小类，每个大小类从一页一页的slab里分，
+// slab开头是struct slab，后面是同样大小的对象，空闲的对象串成链表，
+// 所以分配和释放都是O(1)。对象所在页的开头就是它的slab。
+// 大的请求直接按页分，开头也是一个struct slab，记着页数。
+//
+// 页从sbrk()来，空闲的页按地址排序并合并；堆顶空闲的页多了就用负的sbrk()还给内核。
+// 和以前一样，不能多个线程同时用。
 
-typedef long Align;
+#define PGSIZE 4096
+#define NCLASS 7               // 16, 32, ..., 1024
+#define MINSHIFT 4
+#define MAXSMALL (1 << (MINSHIFT + NCLASS - 1))
+#define BIG NCLASS             // 大块的class
+#define TRIMPAGES 16           // 堆顶空闲的页至少这么多才还给内核
 
-union header {
-  struct {
-    union header *ptr;
-    uint size;
-  } s;
-  Align x;
+struct obj {
+  struct obj *next;
 };
 
-typedef union header Header;
+struct slab {
+  int class;                   // 大小类，或者BIG
+  uint npage;                  // 大块和空闲页：页数
+  int nfree;                   // 空闲对象数
+  int nused;                   // 用过的对象数，后面的还没分出去过
+  struct obj *free;            // 释放了的对象
+  struct slab *next, *prev;    // 有空闲对象的slab；空闲页的链表也用next
+};
 
-static Header base;
-static Header *freep;
+#define HDRSIZE ((sizeof(struct slab) + 15) & ~15)
 
-void
-free(void *ap)
+static struct slab *partial[NCLASS];   // 每个大小类有空闲对象的slab
+static struct slab *freepages;         // 空闲页，按地址排序
+
+static int
+sizeclass(uint n)
 {
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
+  int c = 0;
+
+  while((1u << (MINSHIFT + c)) < n)
+    c++;
+  return c;
+}
+
+static int
+nobj(int c)
+{
+  return (PGSIZE - HDRSIZE) >> (MINSHIFT + c);
+}
+
+// 堆顶空闲的页够多的话还给内核
+static void
+trim(void)
+{
+  struct slab *s, **sp;
+  char *top;
+
+  for(sp = &freepages; (s = *sp) != 0 && s->next != 0; sp = &s->next)
+    ;
+  if(s == 0 || s->npage < TRIMPAGES)
+    return;
+  top = sbrk(0);
+  if((char*)s + s->npage * PGSIZE != top)
+    return;
+  if(sbrk(-(int)(s->npage * PGSIZE)) != (char*)-1)
+    *sp = 0;
+}
+
+// 还回n页，和前后的空闲页合并
+static void
+putpages(struct slab *s, uint n)
+{
+  struct slab *p, *prev = 0;
+
+  for(p = freepages; p != 0 && p < s; prev = p, p = p->next)
+    ;
+  s->npage = n;
+  s->next = p;
+  if(p && (char*)s + s->npage * PGSIZE == (char*)p){
+    s->npage += p->npage;
+    s->next = p->next;
+  }
+  if(prev == 0)
+    freepages = s;
+  else if((char*)prev + prev->npage * PGSIZE == (char*)s){
+    prev->npage += s->npage;
+    prev->next = s->next;
   } else
-    p->s.ptr = bp;
-  freep = p;
+    prev->next = s;
+  trim();
 }
 
-static Header*
-morecore(uint nu)
+// n页连续的内存：先在空闲页里找，从找到的那段的末尾切；没有就sbrk()
+static struct slab*
+getpages(uint n)
 {
+  struct slab *s, **sp;
   char *p;
-  Header *hp;
+  uint64 pad;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == (char*)-1)
+  for(sp = &freepages; (s = *sp) != 0; sp = &s->next){
+    if(s->npage == n){
+      *sp = s->next;
+      return s;
+    }
+    if(s->npage > n){
+      s->npage -= n;
+      return (struct slab*)((char*)s + s->npage * PGSIZE);
+    }
+  }
+  // 别人也可能调用sbrk()，先对齐到页
+  p = sbrk(0);
+  pad = (PGSIZE - (uint64)p % PGSIZE) % PGSIZE;
+  if(n > 0x7fffffff / PGSIZE || (p = sbrk(pad + n * PGSIZE)) == (char*)-1)
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  return (struct slab*)(p + pad);
 }
 
-void*
-malloc(uint nbytes)
+static void*
+bigalloc(uint nbytes)
 {
-  Header *p, *prevp;
-  uint nunits;
+  struct slab *s;
+  uint n;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
+  if(nbytes > 0x7fffffff - HDRSIZE - PGSIZE)
+    return 0;
+  n = (nbytes + HDRSIZE + PGSIZE - 1) / PGSIZE;
+  if((s = getpages(n)) == 0)
+    return 0;
+  s->class = BIG;
+  s->npage = n;
+  return (char*)s + HDRSIZE;
+}
+
+// 新的slab，所有对象都空闲。对象用到的时候才从前往后分出去
+static struct slab*
+newslab(int c)
+{
+  struct slab *s;
+
+  if((s = getpages(1)) == 0)
+    return 0;
+  s->class = c;
+  s->nfree = nobj(c);
+  s->nused = 0;
+  s->free = 0;
+  s->prev = 0;
+  s->next = partial[c];
+  if(partial[c])
+    partial[c]->prev = s;
+  partial[c] = s;
+  return s;
+}
+
+static void
+slabunlink(struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    partial[s->class] = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+void
+free(void *ap)
+{
+  struct slab *s;
+  struct obj *o = ap;
+
+  if(ap == 0)
+    return;
+  s = (struct slab*)((uint64)ap & ~(uint64)(PGSIZE - 1));
+  if(s->class == BIG){
+    putpages(s, s->npage);
+    return;
   }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
-    }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+  o->next = s->free;
+  s->free = o;
+  if(s->nfree++ == 0){
+    // 以前是满的，放回链表
+    s->prev = 0;
+    s->next = partial[s->class];
+    if(s->next)
+      s->next->prev = s;
+    partial[s->class] = s;
+  } else if(s->nfree == nobj(s->class)){
+    // 全空了，把页还回去。堆顶的页要攒够TRIMPAGES才还给内核，所以反复分配释放不会每次都sbrk()
+    slabunlink(s);
+    putpages(s, 1);
   }
 }
+
+void*
+malloc(uint nbytes)
+{
+  struct slab *s;
+  struct obj *o;
+  int c;
+
+  if(nbytes > MAXSMALL)
+    return bigalloc(nbytes);
+  c = sizeclass(nbytes);
+  if((s = partial[c]) == 0 && (s = newslab(c)) == 0)
+    return 0;
+  if((o = s->free) != 0)
+    s->free = o->next;
+  else
+    o = (struct obj*)((char*)s + HDRSIZE + (s->nused++ << (MINSHIFT + c)));
+  if(--s->nfree == 0)
+    slabunlink(s);
+  return o;
+}
@@ -32,6 +32,18 @@ int symlink(char *, char *);
 void *mmap(void *addr, int length, int prot, int flags, int fd, int offset);
 int munmap(void *addr, int length);
 int connect(uint32, uint16, uint16);
+int msync(void *addr, int length, int flags);
+char* sbrkf(int, int);
+int madvise(void *addr, int length, int advice);
+int fadvise(int fd, int offset, int length, int advice);
+int spawn(char *path, char **argv, int *fds);
+int clone(void (*fn)(void*), void *arg, void *stack);
+int futex(int *addr, int op, int val);
+// 上面的fork、exit、exec和spawn在ulib.c里，先写出缓冲的输出再调用这些存根
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
+int _exec(char*, char**);
+int _spawn(char *path, char **argv, int *fds);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -49,4 +61,52 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
-int statistics(void*, int);
\ No newline at end of file
+int statistics(void*, int);
+
+// printf.c：带缓冲的输入输出，每个文件描述符一个缓冲
+#define BUF_NONE 0    // 不缓冲
+#define BUF_LINE 1    // 按行
+#define BUF_FULL 2    // 满了再写
+void setvbuf(int fd, int mode);
+int fflush(int fd);
+void fflushall(void);
+int getc(int fd);
+char* fgets(int fd, char *buf, int max);
+
+// sync.c：用futex()实现的线程同步，clone()的线程之间或者MAP_SHARED的内存上用
+struct mutex {
+  int state;      // 0没锁，1锁了，2锁了并且可能有人在等
+};
+struct cond {
+  int seq;        // 每次signal/broadcast加一
+};
+struct barrier {
+  struct mutex lock;
+  struct cond cv;
+  int nthread;    // 参与的线程数
+  int count;      // 这一轮已经到了的线程数
+  int round;      // 第几轮
+};
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+void barrier_init(struct barrier*, int);
+void barrier_wait(struct barrier*);
+// printf.c的输出缓冲的锁。用户态线程库持有它的线程不能被抢占，不然别的线程等它会把整个进程睡死
+extern struct mutex stdiolock;
+
+// task.c：fork-join的并行任务，工作线程之间互相偷任务
+struct task {
+  void (*fn)(void*);
+  void *arg;
+  int done;       // fn(arg)做完了
+};
+int task_init(int);
+void task_exit(void);
+void task_spawn(struct task*, void (*)(void*), void*);
+void task_sync(struct task*);
+int task_steals(void);
@@ -724,6 +724,357 @@ exectest(char *s)
 
 }
 
+// spawn() a child with its stdout on a pipe and only
+// the descriptors it was given.
+void
+spawntest(char *s)
+{
+  int p[2], fds[3], pid, xstatus, n;
+  char *echoargv[] = { "echo", "OK", 0 };
+  char *badargv[] = { "nosuchprogram", 0 };
+  char buf[4];
+
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  fds[0] = 0;
+  fds[1] = p[1];
+  fds[2] = 2;
+  if((pid = spawn("echo", echoargv, fds)) < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  close(p[1]);
+  // the child did not get p[1] as anything but its stdout,
+  // so the read end sees EOF once it exits.
+  n = 0;
+  while(n < sizeof(buf) && read(p[0], buf + n, 1) == 1)
+    n++;
+  close(p[0]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+  if(n != 3 || buf[0] != 'O' || buf[1] != 'K' || buf[2] != '\n'){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+
+  if(spawn("nosuchprogram", badargv, 0) >= 0){
+    printf("%s: spawn of missing program succeeded\n", s);
+    exit(1);
+  }
+  fds[1] = 42;
+  if(spawn("echo", echoargv, fds) >= 0){
+    printf("%s: spawn with bad fd succeeded\n", s);
+    exit(1);
+  }
+}
+
+// clone() threads share memory with the parent
+// and are reaped by wait() like children.
+int clonecount;
+int clonelock;
+
+void
+clonethread(void *arg)
+{
+  for(int i = 0; i < 1000; i++){
+    while(__sync_lock_test_and_set(&clonelock, 1) != 0)
+      ;
+    clonecount++;
+    __sync_lock_release(&clonelock);
+  }
+  // touch fresh heap memory so the threads fault concurrently
+  char *p = sbrk(4096);
+  if(p == (char*)-1)
+    exit(1);
+  p[0] = 1;
+  exit((uint64)arg);
+}
+
+void
+clonetest(char *s)
+{
+  enum { N=4, SZ=4096 };
+  int tids[N], i, j, xstatus, pid;
+  char *stacks[N];
+
+  clonecount = 0;
+  for(i = 0; i < N; i++){
+    stacks[i] = malloc(SZ);
+    if((tids[i] = clone(clonethread, (void*)(uint64)(i+1), stacks[i] + SZ)) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    if((pid = wait(&xstatus)) < 0){
+      printf("%s: wait failed\n", s);
+      exit(1);
+    }
+    for(j = 0; j < N && tids[j] != pid; j++)
+      ;
+    if(j == N || xstatus != j+1){
+      printf("%s: wrong thread or status\n", s);
+      exit(1);
+    }
+  }
+  if(clonecount != N*1000){
+    printf("%s: count %d, threads do not share memory\n", s, clonecount);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    free(stacks[i]);
+}
+
+// sibling threads write never-touched heap pages into a pipe and
+// read the pipe into never-touched heap pages, so the kernel faults
+// on them (piperead() while holding the pipe's spinlock), while
+// another thread takes copy-on-write faults that must flush the TLB
+// of every hart running the address space.
+enum { CLONEPIPEN=50 };
+volatile int clonepipedone;
+
+void
+clonepipewriter(void *arg)
+{
+  int *fds = arg, fd = fds[1], i;
+  char *p;
+
+  close(fds[0]);
+  for(i = 0; i < CLONEPIPEN; i++){
+    if((p = sbrk(2*4096)) == (char*)-1)
+      break;
+    if(write(fd, p + 100, 4096) != 4096)
+      break;
+  }
+  close(fd);
+  exit(i == CLONEPIPEN ? 0 : 1);
+}
+
+void
+clonepipereader(void *arg)
+{
+  int *fds = arg, fd = fds[0], n, m = 0;
+  char *p = 0;
+
+  close(fds[1]);
+  for(n = 0; n < CLONEPIPEN*4096; n += m){
+    if(n % 4096 == 0 && (p = sbrk(4096)) == (char*)-1)
+      break;
+    if((m = read(fd, p + n % 4096, 4096 - n % 4096)) <= 0)
+      break;
+  }
+  clonepipedone = 1;
+  exit(n == CLONEPIPEN*4096 ? 0 : 1);
+}
+
+void
+clonepipetest(char *s)
+{
+  enum { SZ=4096 };
+  int fds[2], xstatus, i;
+  char *stacks[2], *p;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  clonepipedone = 0;
+  stacks[0] = malloc(SZ);
+  stacks[1] = malloc(SZ);
+  if(clone(clonepipereader, fds, stacks[0] + SZ) < 0 ||
+     clone(clonepipewriter, fds, stacks[1] + SZ) < 0){
+    printf("%s: clone failed\n", s);
+    exit(1);
+  }
+  // the threads have their own copies of the descriptors
+  close(fds[0]);
+  close(fds[1]);
+  while(!clonepipedone){
+    // read fault maps the zero page copy-on-write, the write copies it
+    if((p = sbrk(4096)) == (char*)-1){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    if(p[0] != 0){
+      printf("%s: fresh page not zero\n", s);
+      exit(1);
+    }
+    p[0] = 1;
+  }
+  for(i = 0; i < 2; i++){
+    if(wait(&xstatus) < 0 || xstatus != 0){
+      printf("%s: reader or writer thread failed\n", s);
+      exit(1);
+    }
+  }
+  free(stacks[0]);
+  free(stacks[1]);
+}
+
+// futex() between threads through a mutex and a condition
+// variable, and between processes through a MAP_SHARED page.
+struct mutex futexlock;
+struct cond futexcv;
+int futexready;
+
+void
+futexthread(void *arg)
+{
+  mutex_lock(&futexlock);
+  while(!futexready)
+    cond_wait(&futexcv, &futexlock);
+  mutex_unlock(&futexlock);
+  exit(0);
+}
+
+void
+futexforkthread(void *arg)
+{
+  mutex_lock(&futexlock);
+  mutex_unlock(&futexlock);
+  exit(0);
+}
+
+void
+futextest(char *s)
+{
+  enum { N=3, SZ=4096 };
+  int i, pid, xstatus, *p;
+  char *stacks[N];
+
+  p = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == (int*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  *p = 0;
+  if(futex(p, FUTEX_WAIT, 1) != -1){
+    printf("%s: futex wait with a stale value slept\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    while(*p == 0)
+      futex(p, FUTEX_WAIT, 0);
+    exit(*p == 1 ? 0 : 1);
+  }
+  sleep(1);
+  *p = 1;
+  futex(p, FUTEX_WAKE, 1);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: child not woken through the shared page\n", s);
+    exit(1);
+  }
+  munmap(p, 4096);
+
+  mutex_init(&futexlock);
+  cond_init(&futexcv);
+  futexready = 0;
+  for(i = 0; i < N; i++){
+    stacks[i] = malloc(SZ);
+    if(clone(futexthread, 0, stacks[i] + SZ) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  sleep(1);
+  mutex_lock(&futexlock);
+  futexready = 1;
+  cond_broadcast(&futexcv);
+  mutex_unlock(&futexlock);
+  for(i = 0; i < N; i++){
+    if(wait(&xstatus) < 0 || xstatus != 0){
+      printf("%s: thread failed\n", s);
+      exit(1);
+    }
+  }
+
+  // a thread sleeping on the mutex must still be woken after fork()
+  // makes its page copy-on-write and the unlock copies it.
+  mutex_lock(&futexlock);
+  if(clone(futexforkthread, 0, stacks[0] + SZ) < 0){
+    printf("%s: clone failed\n", s);
+    exit(1);
+  }
+  sleep(1);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(0);
+  if(wait(&xstatus) != pid){
+    printf("%s: wrong child\n", s);
+    exit(1);
+  }
+  mutex_unlock(&futexlock);
+  if(wait(&xstatus) < 0 || xstatus != 0){
+    printf("%s: thread not woken after fork\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    free(stacks[i]);
+}
+
+// each task splits [lo, hi) in half and offers one half to the other workers.
+struct tasksum {
+  int lo, hi;
+  uint64 sum;
+};
+
+static void
+tasksum(void *xa)
+{
+  struct tasksum *a = xa, x, y;
+  struct task t;
+
+  if(a->hi - a->lo <= 16){
+    a->sum = 0;
+    for(int i = a->lo; i < a->hi; i++)
+      a->sum += i;
+    return;
+  }
+  x.lo = a->lo;
+  x.hi = y.lo = (a->lo + a->hi) / 2;
+  y.hi = a->hi;
+  task_spawn(&t, tasksum, &x);
+  tasksum(&y);
+  task_sync(&t);
+  a->sum = x.sum + y.sum;
+}
+
+// task.c: workers steal tasks from each other and still get the right sum.
+void
+tasktest(char *s)
+{
+  struct tasksum a;
+
+  for(int nw = 1; nw <= 4; nw++){
+    if(task_init(nw) < 0){
+      printf("%s: task_init(%d) failed\n", s, nw);
+      exit(1);
+    }
+    a.lo = 0;
+    a.hi = 100000;
+    tasksum(&a);
+    task_exit();
+    if(a.sum != 100000ULL * 99999 / 2){
+      printf("%s: %d workers: wrong sum %d\n", s, nw, (int)a.sum);
+      exit(1);
+    }
+  }
+}
+
 // simple fork and pipe read/write
 
 void
@@ -1080,6 +1431,90 @@ mem(char *s)
   }
 }
 
+// blocks of different sizes don't overlap, and once they are all
+// freed the memory at the top of the heap goes back to the kernel.
+void
+malloctest(char *s)
+{
+  enum { N = 500 };
+  char *p[N], *start = sbrk(0);
+  int i, j;
+
+  for(i = 0; i < N; i++){
+    int sz = (i % 5 == 0) ? 5000 + i * 7 : 1 + i;
+    if((p[i] = malloc(sz)) == 0){
+      printf("%s: malloc(%d) failed\n", s, sz);
+      exit(1);
+    }
+    memset(p[i], i & 0xff, sz);
+  }
+  for(i = 0; i < N; i++){
+    int sz = (i % 5 == 0) ? 5000 + i * 7 : 1 + i;
+    for(j = 0; j < sz; j++){
+      if(p[i][j] != (char)(i & 0xff)){
+        printf("%s: block %d overwritten\n", s, i);
+        exit(1);
+      }
+    }
+  }
+  for(i = 0; i < N; i++)
+    free(p[i]);
+  if(sbrk(0) - start > 64*1024){
+    printf("%s: heap grew by %d after freeing everything\n", s, (int)(sbrk(0) - start));
+    exit(1);
+  }
+}
+
+// printf.c buffering: nothing is written before fflush(), the buffer is
+// flushed before fork() so the child doesn't write it again, and fgets()
+// returns the lines of one read() one at a time.
+void
+stdiotest(char *s)
+{
+  int fds[2], pid, n;
+  char buf[32];
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  setvbuf(fds[1], BUF_FULL);
+  fprintf(fds[1], "a%d\n", 1);
+  fprintf(fds[1], "b%s\n", "2");
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(0);
+  wait(0);
+  fprintf(fds[1], "c3\n");
+  fflush(fds[1]);
+  setvbuf(fds[1], BUF_NONE);
+  close(fds[1]);
+
+  setvbuf(fds[0], BUF_FULL);
+  fgets(fds[0], buf, sizeof(buf));
+  if(strcmp(buf, "a1\n") != 0){
+    printf("%s: first line %s\n", s, buf);
+    exit(1);
+  }
+  fgets(fds[0], buf, sizeof(buf));
+  if(strcmp(buf, "b2\n") != 0){
+    printf("%s: second line %s\n", s, buf);
+    exit(1);
+  }
+  fgets(fds[0], buf, sizeof(buf));
+  n = strlen(buf);
+  fgets(fds[0], buf + n, sizeof(buf) - n);
+  if(strcmp(buf, "c3\n") != 0){
+    printf("%s: output written twice or lost: %s\n", s, buf);
+    exit(1);
+  }
+  setvbuf(fds[0], BUF_NONE);
+  close(fds[0]);
+}
+
 // More file system tests
 
 // two processes write to the same file descriptor
@@ -2797,6 +3232,11 @@ main(int argc, char *argv[])
     {sharedfd, "sharedfd"},
     {dirtest, "dirtest"},
     {exectest, "exectest"},
+    {spawntest, "spawntest"},
+    {clonetest, "clonetest"},
+    {clonepipetest, "clonepipetest"},
+    {futextest, "futextest"},
+    {tasktest, "tasktest"},
     {bigargtest, "bigargtest"},
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
@@ -2815,6 +3255,8 @@ main(int argc, char *argv[])
     {exitiputtest, "exitiput"},
     {iputtest, "iput"},
     {mem, "mem"},
+    {malloctest, "malloctest"},
+    {stdiotest, "stdiotest"},
     {pipe1, "pipe1"},
     {killstatus, "killstatus"},
     {preempt, "preempt"},
@@ -6,24 +6,27 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# 第二个参数是存根的名字，默认和系统调用同名。
+# fork、exec、spawn和exit的存根前面加了_，ulib.c里同名的函数先写出缓冲的输出再调用它们
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $sym = shift || $name;
+    print ".global $sym\n";
+    print "${sym}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
-entry("fork");
-entry("exit");
+entry("fork", "_fork");
+entry("exit", "_exit");
 entry("wait");
 entry("pipe");
 entry("read");
 entry("write");
 entry("close");
 entry("kill");
-entry("exec");
+entry("exec", "_exec");
 entry("open");
 entry("mknod");
 entry("unlink");
@@ -44,3 +47,10 @@ entry("symlink");
 entry("mmap");
 entry("munmap");
 entry("connect");
+entry("msync");
+entry("sbrkf");
+entry("madvise");
+entry("fadvise");
+entry("spawn", "_spawn");
+entry("clone");
+entry("futex");
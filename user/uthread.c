@@ -8,7 +8,7 @@
 #define RUNNABLE    0x2 // 可运行
 
 #define STACK_SIZE  8192
-#define MAX_THREAD  4
+#define MAX_THREAD  5
 
 struct context {
     uint64 ra;
@@ -29,17 +29,146 @@ struct context {
     uint64 s11;
 };
 
+// 闹钟处理函数的参数：内核放在用户栈上的被打断时的寄存器，
+// 布局和kernel/proc.h里的struct trapframe一样，sigreturn()按它恢复
+struct sigframe {
+  uint64 kernel_satp, kernel_sp, kernel_trap, epc, kernel_hartid;
+  uint64 ra, sp, gp, tp, t0, t1, t2, s0, s1;
+  uint64 a0, a1, a2, a3, a4, a5, a6, a7;
+  uint64 s2, s3, s4, s5, s6, s7, s8, s9, s10, s11;
+  uint64 t3, t4, t5, t6;
+};
+
 struct thread {
   char       stack[STACK_SIZE]; /* 线程栈 */
   int        state;             /* FREE, RUNNING, RUNNABLE */
-  struct context context;
+  struct context context;       /* 自己让出CPU时保存的寄存器 */
+  int        preempted;         /* 被抢占的话寄存器在frame里 */
+  struct sigframe frame;
+  void       (*func)();
+  struct thread *next;          /* 就绪队列 */
+  // 统计
+  int        nrun;              /* 被调度的次数 */
+  int        npreempt;          /* 被抢占的次数 */
+  int        start;             /* 这次开始运行的时间 */
+  int        runticks;          /* 一共运行的时间 */
 };
 struct thread all_thread[MAX_THREAD];
 struct thread *current_thread;
 extern void thread_switch(uint64, uint64);
-              
+extern void thread_resume(uint64, uint64, uint64);
+extern char thread_resume_end[];
+void thread_schedule(void);
+
+// 可运行的线程按先来先运行排队
+struct thread *runq_head, *runq_tail;
+
+// 在改就绪队列或者正在切换线程，闹钟处理函数不能切换
+volatile int nopreempt;
+
+static void
+enqueue(struct thread *t)
+{
+  t->next = 0;
+  if(runq_tail)
+    runq_tail->next = t;
+  else
+    runq_head = t;
+  runq_tail = t;
+}
+
+static struct thread*
+dequeue(void)
+{
+  struct thread *t = runq_head;
+
+  if(t){
+    runq_head = t->next;
+    if(runq_head == 0)
+      runq_tail = 0;
+  }
+  return t;
+}
+
+// 记账，next成为当前线程
+static void
+thread_run(struct thread *next)
+{
+  int now = uptime();
+
+  current_thread->runticks += now - current_thread->start;
+  next->start = now;
+  next->nrun++;
+  next->state = RUNNING;
+  current_thread = next;
+}
+
+static void
+thread_stats(void)
+{
+  struct thread *t;
+
+  printf("thread  runs  preempted  ticks\n");
+  for(t = all_thread; t < all_thread + MAX_THREAD; t++){
+    if(t->nrun > 0)
+      printf("%d  %d  %d  %d\n", (int)(t - all_thread), t->nrun, t->npreempt, t->runticks);
+  }
+}
+
+// 时间片用完了。正在调度或者持有stdiolock的话什么也不做；否则把当前线程的寄存器存起来，
+// 放回就绪队列，把f改成下一个线程的寄存器，sigreturn()就回到了下一个线程
+static void
+thread_preempt(struct sigframe *f)
+{
+  struct thread *t = current_thread, *next;
+
+  if(nopreempt || stdiolock.state ||
+     (f->epc >= (uint64)thread_resume && f->epc < (uint64)thread_resume_end))
+    sigreturn();
+  if((next = dequeue()) == 0)
+    sigreturn();
+  t->frame = *f;
+  t->preempted = 1;
+  t->npreempt++;
+  t->state = RUNNABLE;
+  enqueue(t);
+  thread_run(next);
+  if(next->preempted){
+    next->preempted = 0;
+    *f = next->frame;
+  } else {
+    // 从thread_switch()返回的地方接着运行，只需要callee-saved寄存器
+    f->epc = f->ra = next->context.ra;
+    f->sp = next->context.sp;
+    f->s0 = next->context.s0;
+    f->s1 = next->context.s1;
+    f->s2 = next->context.s2;
+    f->s3 = next->context.s3;
+    f->s4 = next->context.s4;
+    f->s5 = next->context.s5;
+    f->s6 = next->context.s6;
+    f->s7 = next->context.s7;
+    f->s8 = next->context.s8;
+    f->s9 = next->context.s9;
+    f->s10 = next->context.s10;
+    f->s11 = next->context.s11;
+  }
+  sigreturn();
+}
+
+// 新线程从这里开始
+static void
+thread_start(void)
+{
+  nopreempt = 0;
+  current_thread->func();
+  current_thread->state = FREE;
+  thread_schedule();
+}
+
+// slice是时间片的tick数，0表示不抢占，线程自己调用thread_yield()让出CPU
 void 
-thread_init(void)
+thread_init(int slice)
 {
   // main() is thread 0, which will make the first invocation to
   // thread_schedule().  it needs a stack so that the first thread_switch() can
@@ -48,42 +177,35 @@ thread_init(void)
   // a RUNNABLE thread.
   current_thread = &all_thread[0];
   current_thread->state = RUNNING;
+  current_thread->start = uptime();
+  if(slice > 0)
+    sigalarm(slice, thread_preempt);
 }
 
 void 
 thread_schedule(void)
 {
-  struct thread *t, *next_thread;
-
-  /* 寻找其他可运行的线程. */
-  next_thread = 0;
-  t = current_thread + 1;
-  for(int i = 0; i < MAX_THREAD; i++){
-    if(t >= all_thread + MAX_THREAD)
-      t = all_thread;
-    if(t->state == RUNNABLE) {
-      next_thread = t;
-      break;
-    }
-    t = t + 1;
-  }
+  struct thread *t = current_thread, *next;
 
-  if (next_thread == 0) {
+  nopreempt = 1;
+  if(t->state == RUNNABLE)
+    enqueue(t);
+  if((next = dequeue()) == 0){
     printf("thread_schedule: no runnable threads\n");
+    thread_stats();
     exit(-1);
   }
 
-  if (current_thread != next_thread) {         /* switch threads?  */
-    next_thread->state = RUNNING;
-    t = current_thread;
-    current_thread = next_thread;
-    /* YOUR CODE HERE
-     * Invoke thread_switch to switch from t to next_thread:
-     * thread_switch(??, ??);
-     */
-     thread_switch((uint64)(&t->context), (uint64)(&current_thread->context));
+  if (next != t) {         /* switch threads?  */
+    thread_run(next);
+    if(next->preempted){
+      next->preempted = 0;
+      thread_resume((uint64)&t->context, (uint64)&next->frame, (uint64)&nopreempt);
+    } else
+      thread_switch((uint64)(&t->context), (uint64)(&next->context));
   } else
-    next_thread = 0;
+    t->state = RUNNING;
+  nopreempt = 0;
 }
 
 void 
@@ -94,10 +216,18 @@ thread_create(void (*func)())
   for (t = all_thread; t < all_thread + MAX_THREAD; t++) {
     if (t->state == FREE) break;
   }
+  if (t == all_thread + MAX_THREAD) {
+    printf("thread_create: too many threads\n");
+    exit(-1);
+  }
+  nopreempt = 1;
   t->state = RUNNABLE;
-  // YOUR CODE HERE
-  t->context.ra = (uint64)func;
+  t->func = func;
+  t->preempted = 0;
+  t->context.ra = (uint64)thread_start;
   t->context.sp = (uint64)t->stack + STACK_SIZE;
+  enqueue(t);
+  nopreempt = 0;
 }
 
 void 
@@ -108,7 +238,7 @@ thread_yield(void)
 }
 
 volatile int a_started, b_started, c_started;
-volatile int a_n, b_n, c_n;
+volatile int a_n, b_n, c_n, d_n;
 
 void 
 thread_a(void)
@@ -170,15 +300,33 @@ thread_c(void)
   thread_schedule();
 }
 
+// 一直算，不让出CPU，没有抢占的话别的线程永远运行不了
+void
+thread_d(void)
+{
+  while(a_n < 100 || b_n < 100 || c_n < 100)
+    d_n++;
+  printf("thread_d: exit after %d spins\n", d_n);
+
+  current_thread->state = FREE;
+  thread_schedule();
+}
+
+// 用法：uthread [时间片的tick数]
+// 给了时间片的话打开抢占，再加一个不让出CPU的线程thread_d
 int 
 main(int argc, char *argv[]) 
 {
+  int slice = argc > 1 ? atoi(argv[1]) : 0;
+
   a_started = b_started = c_started = 0;
-  a_n = b_n = c_n = 0;
-  thread_init();
+  a_n = b_n = c_n = d_n = 0;
+  thread_init(slice);
   thread_create(thread_a);
   thread_create(thread_b);
   thread_create(thread_c);
+  if(slice > 0)
+    thread_create(thread_d);
   thread_schedule();
   exit(0);
 }
@@ -0,0 +1,127 @@
+//
+// 并行任务（task.c）的性能测试：分别用1到N个工作线程
+// 递归地算fib(n)，和并行地在整个文件系统里找某个名字的文件，比较用的时间。
+// 用法：wsbench [最多的线程数 [n [文件名]]]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define CUTOFF 15     // 比这小的fib直接算
+#define NBATCH 8      // 每个目录一次最多并行找几个子目录
+#define MAXPATH 128
+#define NFIND 20      // 文件系统很小，多找几遍
+
+struct fibarg {
+  int n;
+  int r;
+};
+
+static char *name = "README";
+static int nfound;
+
+static int
+fib(int n)
+{
+  return n < 2 ? n : fib(n-1) + fib(n-2);
+}
+
+static void
+pfib(void *xa)
+{
+  struct fibarg *a = xa;
+  struct fibarg x, y;
+  struct task t;
+
+  if(a->n < CUTOFF){
+    a->r = fib(a->n);
+    return;
+  }
+  x.n = a->n - 1;
+  y.n = a->n - 2;
+  task_spawn(&t, pfib, &x);
+  pfib(&y);
+  task_sync(&t);
+  a->r = x.r + y.r;
+}
+
+// 在目录dir里找，每个子目录一个任务
+static void
+pfind(void *xa)
+{
+  char *dir = xa;
+  char buf[MAXPATH], sub[NBATCH][MAXPATH], *p;
+  struct task t[NBATCH];
+  struct dirent de;
+  struct stat st;
+  int fd, i, n = 0;
+
+  if((fd = open(dir, 0)) < 0)
+    return;
+  if(strlen(dir) + 1 + DIRSIZ + 1 > sizeof buf){
+    close(fd);
+    return;
+  }
+  strcpy(buf, dir);
+  p = buf + strlen(buf);
+  if(p[-1] != '/')
+    *p++ = '/';
+  while(read(fd, &de, sizeof(de)) == sizeof(de)){
+    if(de.inum == 0 || !strcmp(de.name, ".") || !strcmp(de.name, ".."))
+      continue;
+    memmove(p, de.name, DIRSIZ);
+    p[DIRSIZ] = 0;
+    if(stat(buf, &st) < 0)
+      continue;
+    if(st.type == T_DIR){
+      strcpy(sub[n], buf);
+      task_spawn(&t[n], pfind, sub[n]);
+      if(++n == NBATCH){
+        for(i = 0; i < n; i++)
+          task_sync(&t[i]);
+        n = 0;
+      }
+    } else if(st.type == T_FILE && !strcmp(p, name)){
+      __atomic_add_fetch(&nfound, 1, __ATOMIC_RELAXED);
+    }
+  }
+  close(fd);
+  for(i = 0; i < n; i++)
+    task_sync(&t[i]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nw, maxw, t0, t1, t2;
+  struct fibarg a;
+
+  maxw = argc > 1 ? atoi(argv[1]) : 3;
+  a.n = argc > 2 ? atoi(argv[2]) : 27;
+  if(argc > 3)
+    name = argv[3];
+  if(maxw <= 0 || a.n < 0){
+    fprintf(2, "usage: wsbench [maxworkers [n [name]]]\n");
+    exit(1);
+  }
+
+  for(nw = 1; nw <= maxw; nw++){
+    if(task_init(nw) < 0){
+      fprintf(2, "wsbench: task_init(%d) failed\n", nw);
+      exit(1);
+    }
+    t0 = uptime();
+    pfib(&a);
+    t1 = uptime();
+    nfound = 0;
+    for(int i = 0; i < NFIND; i++)
+      pfind("/");
+    t2 = uptime();
+    printf("%d workers: fib(%d)=%d %d ticks, find %s x%d: %d found %d ticks, %d steals\n",
+           nw, a.n, a.r, t1 - t0, name, NFIND, nfound, t2 - t1, task_steals());
+    task_exit();
+  }
+  exit(0);
+}
@@ -45,14 +45,11 @@ int main(int argc, char *argv[])
         }
 
         _argv[argv_cnt] = 0;
-        if (fork() == 0)
-        {
-            exec(_argv[0], _argv);
-        }
+        // 直接从程序创建子进程，不用先复制xargs
+        if (spawn(_argv[0], _argv, 0) < 0)
+            fprintf(2, "xargs: exec %s failed\n", _argv[0]);
         else
-        {
             wait(0);
-        }
     }
     exit(0);
 }
\ No newline at end of file